@@ -0,0 +1,93 @@
+// Per-operation latency of the PhysicalMemory strategies under a fragmenting
+// workload: the pool is filled with random sizes, then random frees and
+// allocations keep it near full. Every malloc and free is timed on its own,
+// so the tail columns show the worst case rather than the average.
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <string>
+#include <cstdlib>
+#include "../include/PhysicalMemory.h"
+
+using namespace std;
+using namespace std::chrono;
+
+static int allocate(PhysicalMemory &pm, const string &strategy, int sz)
+{
+    if (strategy == "first")
+        return pm.allocateFirstFit(sz);
+    if (strategy == "best")
+        return pm.allocateBestFit(sz);
+    if (strategy == "worst")
+        return pm.allocateWorstFit(sz);
+    return pm.allocateTlsf(sz);
+}
+
+static void run(const string &strategy, int poolSize, long long ops)
+{
+    PhysicalMemory pm(poolSize);
+    // Same seed for every strategy, so all of them see the same requests
+    mt19937 rng(7);
+    auto nextSize = [&]()
+    { return 16 + (int)(rng() % (rng() % 8 ? 256 : 4096)); };
+    vector<int> held;
+    for (;;)
+    {
+        int off = allocate(pm, strategy, nextSize());
+        if (off < 0)
+            break;
+        held.push_back(off);
+    }
+
+    vector<double> allocNs, freeNs;
+    allocNs.reserve(ops);
+    freeNs.reserve(ops);
+    long long failures = 0;
+    for (long long i = 0; i < ops; i++)
+    {
+        if (!held.empty())
+        {
+            size_t k = rng() % held.size();
+            auto t0 = steady_clock::now();
+            pm.freeMem(held[k]);
+            freeNs.push_back(duration<double, nano>(steady_clock::now() - t0).count());
+            held[k] = held.back();
+            held.pop_back();
+        }
+        int sz = nextSize();
+        auto t0 = steady_clock::now();
+        int off = allocate(pm, strategy, sz);
+        allocNs.push_back(duration<double, nano>(steady_clock::now() - t0).count());
+        if (off < 0)
+            failures++;
+        else
+            held.push_back(off);
+    }
+
+    auto report = [&](const char *op, vector<double> &ns)
+    {
+        sort(ns.begin(), ns.end());
+        double sum = 0;
+        for (double v : ns)
+            sum += v;
+        auto pct = [&](double p)
+        { return ns[min(ns.size() - 1, (size_t)(p * ns.size()))]; };
+        cout << strategy << "," << op << "," << held.size() << "," << sum / ns.size() << "," << pct(0.5) << ","
+             << pct(0.99) << "," << pct(0.999) << "," << ns.back() << "," << (double)failures / ops << "\n";
+    };
+    report("malloc", allocNs);
+    report("free", freeNs);
+}
+
+int main(int argc, char **argv)
+{
+    long long ops = argc > 1 ? atoll(argv[1]) : 200000;
+    int poolSize = argc > 2 ? atoi(argv[2]) : 1 << 22;
+
+    cout << "strategy,op,live_blocks,mean_ns,p50_ns,p99_ns,p999_ns,max_ns,malloc_failure_rate\n";
+    for (const char *s : {"first", "best", "worst", "tlsf"})
+        run(s, poolSize, ops);
+    return 0;
+}
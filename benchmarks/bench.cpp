@@ -0,0 +1,603 @@
+// Microbenchmark suite for the allocators and caches. Every (target, workload,
+// scale) case runs in a forked child, so its peak RSS is its own, and reports
+// ns/op, a latency distribution and peak RSS as JSON or CSV.
+//
+// Workloads (synthetic, seeded):
+//   uniform   allocators: sizes uniform in [16, 512], frees of random live
+//             blocks; caches: addresses uniform over the footprint
+//   zipf      allocators: Zipf(1.1) over 64 size classes of 16 bytes, small
+//             ones most popular; caches: Zipf(0.99) block popularity, hot
+//             blocks scattered over the footprint
+//   stride    caches only: one access every --stride bytes, wrapping around
+//             the footprint
+//   prodcons  allocators: FIFO lifetimes, the oldest block is freed first;
+//             caches: a producer writes a ring buffer that a consumer reads
+//             half a ring behind
+//
+// Timing: operations run in chunks of 64K. Even chunks run back to back and
+// give ns/op; odd chunks time every operation on its own and feed a
+// log-linear histogram (8 buckets per power of two, so within 12.5%) for the
+// percentiles. Per-operation times include the clock read, reported as
+// timer_ns. Generating a chunk's inputs is never timed.
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../include/PhysicalMemory.h"
+#include "../include/Buddy.h"
+#include "../include/SlabAllocator.h"
+#include "../include/Cache.h"
+#include "../include/MultilevelCache.h"
+
+using namespace std;
+using namespace std::chrono;
+
+static const size_t CHUNK = 1 << 16;
+
+struct Options
+{
+    string suite = "all";
+    string target = "";
+    string workload = "all";
+    vector<long long> scales = {1000000};
+    int live = 1024;
+    long long footprint = 64LL << 20;
+    int stride = 256;
+    string format = "json";
+    string cacheConfig = "configs/cache_hierarchy.cfg";
+    unsigned seed = 42;
+};
+
+// Log-linear latency histogram over nanoseconds
+class Histogram
+{
+    static const int SUB = 8;
+    vector<long long> counts;
+    long long total = 0;
+    long long maxNs = 0;
+
+    static int bucket(long long ns)
+    {
+        if (ns < SUB)
+            return (int)ns;
+        int e = 63 - __builtin_clzll(ns);
+        return SUB + (e - 3) * SUB + (int)((ns >> (e - 3)) - SUB);
+    }
+    static long long upperBound(int b)
+    {
+        if (b < SUB)
+            return b;
+        int e = (b - SUB) / SUB + 3;
+        long long m = (b - SUB) % SUB + SUB;
+        return ((m + 1) << (e - 3)) - 1;
+    }
+
+public:
+    Histogram() : counts(SUB + 61 * SUB) {}
+
+    void add(long long ns)
+    {
+        counts[bucket(ns)]++;
+        total++;
+        maxNs = max(maxNs, ns);
+    }
+    long long percentile(double p) const
+    {
+        long long rank = (long long)(p * total), seen = 0;
+        for (size_t b = 0; b < counts.size(); b++)
+        {
+            seen += counts[b];
+            if (seen > rank)
+                return min(upperBound(b), maxNs);
+        }
+        return maxNs;
+    }
+    long long maxValue() const { return maxNs; }
+};
+
+// Written by the child through a pipe, so plain data only
+struct Result
+{
+    char target[48];
+    char workload[16];
+    long long ops;
+    double nsPerOp;
+    long long p50, p90, p99, p999, maxNs;
+    double timerNs;
+    long peakRssKb;
+    long long failedAllocs; // -1 for caches
+    double hitRate;         // -1 for allocators
+};
+
+// Zipf(s) over n ranks, sampled by binary search over the CDF
+class Zipf
+{
+    vector<double> cdf;
+
+public:
+    Zipf(int n, double s) : cdf(n)
+    {
+        double sum = 0;
+        for (int i = 0; i < n; i++)
+            cdf[i] = sum += 1.0 / pow(i + 1, s);
+        for (double &c : cdf)
+            c /= sum;
+    }
+    int operator()(mt19937_64 &rng) const
+    {
+        double u = (rng() >> 11) * (1.0 / 9007199254740992.0);
+        return min<int>(upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+    }
+};
+
+static double timerOverhead()
+{
+    long long best = 1LL << 60;
+    for (int i = 0; i < 1000; i++)
+    {
+        auto t0 = steady_clock::now();
+        auto t1 = steady_clock::now();
+        best = min<long long>(best, duration_cast<nanoseconds>(t1 - t0).count());
+    }
+    return best;
+}
+
+// Runs ops operations in chunks: prepare(chunk, n) fills the inputs untimed,
+// step(i) performs operation i of the chunk
+static void runTimed(long long ops, Result &r, const function<void(size_t)> &prepare, const function<void(size_t)> &step)
+{
+    Histogram hist;
+    double fastSecs = 0;
+    long long fastOps = 0;
+    for (long long done = 0, chunk = 0; done < ops; chunk++)
+    {
+        size_t n = (size_t)min<long long>(CHUNK, ops - done);
+        prepare(n);
+        if (chunk % 2 == 0 || ops <= (long long)CHUNK)
+        {
+            auto t0 = steady_clock::now();
+            for (size_t i = 0; i < n; i++)
+                step(i);
+            fastSecs += duration<double>(steady_clock::now() - t0).count();
+            fastOps += n;
+        }
+        // A single chunk is run twice, once each way
+        if (chunk % 2 == 1 || ops <= (long long)CHUNK)
+        {
+            if (ops <= (long long)CHUNK)
+                prepare(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                auto t0 = steady_clock::now();
+                step(i);
+                hist.add(duration_cast<nanoseconds>(steady_clock::now() - t0).count());
+            }
+        }
+        done += n;
+    }
+    r.nsPerOp = fastOps ? fastSecs * 1e9 / fastOps : 0;
+    r.p50 = hist.percentile(0.5);
+    r.p90 = hist.percentile(0.9);
+    r.p99 = hist.percentile(0.99);
+    r.p999 = hist.percentile(0.999);
+    r.maxNs = hist.maxValue();
+}
+
+// Uniform allocator interface for the benchmark: alloc returns an offset or
+// -1, free takes an offset returned by alloc
+struct AllocTarget
+{
+    string name;
+    function<unique_ptr<void, void (*)(void *)>()> make;
+    function<long long(void *, int)> alloc;
+    function<void(void *, long long)> release;
+};
+
+template <class T>
+static unique_ptr<void, void (*)(void *)> own(T *p)
+{
+    return unique_ptr<void, void (*)(void *)>(p, [](void *q)
+                                              { delete (T *)q; });
+}
+
+static const int POOL = 1 << 22;
+
+static vector<AllocTarget> allocTargets()
+{
+    vector<AllocTarget> t;
+    const char *names[] = {"first", "best", "worst", "tlsf"};
+    for (int s = 0; s < 4; s++)
+    {
+        t.push_back({string("PhysicalMemory/") + names[s], []
+                     { return own(new PhysicalMemory(POOL)); },
+                     [s](void *p, int sz) -> long long
+                     {
+                         PhysicalMemory &pm = *(PhysicalMemory *)p;
+                         return s == 0 ? pm.allocateFirstFit(sz) : s == 1 ? pm.allocateBestFit(sz)
+                                                               : s == 2   ? pm.allocateWorstFit(sz)
+                                                                          : pm.allocateTlsf(sz);
+                     },
+                     [](void *p, long long off)
+                     { ((PhysicalMemory *)p)->freeMem((int)off); }});
+    }
+    t.push_back({"Buddy", []
+                 { return own(new Buddy(POOL, 4)); },
+                 [](void *p, int sz) -> long long
+                 { return ((Buddy *)p)->access(sz); },
+                 [](void *p, long long off)
+                 { ((Buddy *)p)->free(off); }});
+    t.push_back({"SlabAllocator", []
+                 { return own(new SlabAllocator(POOL)); },
+                 [](void *p, int sz) -> long long
+                 { return ((SlabAllocator *)p)->alloc(0, sz); },
+                 [](void *p, long long off)
+                 { ((SlabAllocator *)p)->free(0, off); }});
+    return t;
+}
+
+static void benchAllocator(const AllocTarget &target, const string &workload, long long ops, const Options &opt, Result &r)
+{
+    auto alloc = target.make();
+    mt19937_64 rng(opt.seed);
+    Zipf sizes(64, 1.1);
+    // Live offsets; prodcons uses it as a FIFO ring from head
+    vector<long long> live;
+    live.reserve(opt.live);
+    size_t head = 0;
+    vector<int> size(CHUNK);
+    vector<unsigned> pick(CHUNK);
+    vector<char> doAlloc(CHUNK);
+    long long failed = 0;
+    bool fifo = workload == "prodcons";
+
+    auto prepare = [&](size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            size[i] = workload == "zipf" ? 16 * (sizes(rng) + 1) : 16 + (int)(rng() % 497);
+            pick[i] = (unsigned)rng();
+            doAlloc[i] = rng() & 1;
+        }
+    };
+    auto step = [&](size_t i)
+    {
+        size_t n = live.size() - (fifo ? head : 0);
+        bool a = n == 0 || (n < (size_t)opt.live && (fifo || doAlloc[i]));
+        if (a)
+        {
+            long long off = target.alloc(alloc.get(), size[i]);
+            if (off < 0)
+                failed++;
+            else
+                live.push_back(off);
+        }
+        else if (fifo)
+        {
+            target.release(alloc.get(), live[head++]);
+            if (head == live.size() || head > (size_t)opt.live)
+            {
+                live.erase(live.begin(), live.begin() + head);
+                head = 0;
+            }
+        }
+        else
+        {
+            size_t k = pick[i] % live.size();
+            target.release(alloc.get(), live[k]);
+            live[k] = live.back();
+            live.pop_back();
+        }
+    };
+    runTimed(ops, r, prepare, step);
+    r.failedAllocs = failed;
+    r.hitRate = -1;
+}
+
+struct CacheTarget
+{
+    string name;
+    // Returns true on a hit (in any level for the hierarchy)
+    function<bool(unsigned long long, bool)> access;
+};
+
+static void benchCache(const string &name, const string &workload, long long ops, const Options &opt, Result &r)
+{
+    unique_ptr<CacheBase> single;
+    unique_ptr<MultilevelCache> hierarchy;
+    if (name == "MultilevelCache")
+    {
+        HierarchyConfig cfg;
+        string err;
+        if (!loadHierarchyConfig(opt.cacheConfig, cfg, err))
+            cfg = defaultHierarchyConfig();
+        hierarchy.reset(new MultilevelCache(cfg));
+    }
+    else
+    {
+        single = makeCache(name.substr(name.find('/') + 1), 32768, 64, 8);
+    }
+    int levels = hierarchy ? hierarchy->levelCount() : 1;
+
+    mt19937_64 rng(opt.seed);
+    unsigned long long blocks = 1;
+    while (blocks * 2 * 64 <= (unsigned long long)opt.footprint)
+        blocks *= 2;
+    unique_ptr<Zipf> zipf;
+    if (workload == "zipf")
+        zipf.reset(new Zipf((int)min<unsigned long long>(blocks, 1 << 22), 0.99));
+    unsigned long long ring = min<unsigned long long>(blocks * 64, 4 << 20);
+    vector<unsigned long long> addr(CHUNK);
+    vector<char> write(CHUNK);
+    long long pos = 0, hits = 0;
+
+    auto prepare = [&](size_t n)
+    {
+        for (size_t i = 0; i < n; i++, pos++)
+        {
+            write[i] = 0;
+            if (workload == "uniform")
+                addr[i] = rng() % (blocks * 64);
+            else if (workload == "zipf")
+                // Odd multiplier mod a power of two: a bijection that scatters hot ranks
+                addr[i] = ((unsigned long long)(*zipf)(rng) * 0x9E3779B1ULL & (blocks - 1)) * 64;
+            else if (workload == "stride")
+                addr[i] = (unsigned long long)pos * opt.stride % (blocks * 64);
+            else
+            {
+                unsigned long long p = (unsigned long long)(pos / 2) * 64 % ring;
+                write[i] = pos % 2 == 0;
+                addr[i] = write[i] ? p : (p + ring / 2) % ring;
+            }
+        }
+    };
+    auto step = [&](size_t i)
+    {
+        if (hierarchy)
+            hits += hierarchy->lookup(addr[i], write[i]) < levels;
+        else
+            hits += single->access(addr[i]);
+    };
+    runTimed(ops, r, prepare, step);
+    // The histogram pass replays single-chunk runs, so count both passes
+    long long accesses = ops <= (long long)CHUNK ? 2 * ops : ops;
+    r.hitRate = (double)hits / accesses;
+    r.failedAllocs = -1;
+}
+
+static long peakRssKb()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// Runs one case in a child process and collects its Result through a pipe;
+// runs it in-process if fork fails
+static bool runCase(const function<void(Result &)> &body, Result &r)
+{
+    int fds[2];
+    pid_t pid = -1;
+    // Nothing may be left buffered for the child to print a second time
+    cout.flush();
+    fflush(stdout);
+    if (pipe(fds) == 0)
+        pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        body(r);
+        r.peakRssKb = peakRssKb();
+        ssize_t n = write(fds[1], &r, sizeof(r));
+        // exit, not _exit: a -fprofile-generate build writes its profile at exit
+        exit(n == (ssize_t)sizeof(r) ? 0 : 1);
+    }
+    if (pid < 0)
+    {
+        body(r);
+        r.peakRssKb = peakRssKb();
+        return true;
+    }
+    close(fds[1]);
+    size_t got = 0;
+    while (got < sizeof(r))
+    {
+        ssize_t n = read(fds[0], (char *)&r + got, sizeof(r) - got);
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return got == sizeof(r);
+}
+
+static bool parseScale(const string &s, long long &v)
+{
+    char *end;
+    double d = strtod(s.c_str(), &end);
+    string suffix = end;
+    if (suffix == "K" || suffix == "k")
+        d *= 1e3;
+    else if (suffix == "M" || suffix == "m")
+        d *= 1e6;
+    else if (suffix == "G" || suffix == "g")
+        d *= 1e9;
+    else if (!suffix.empty())
+        return false;
+    v = (long long)d;
+    return v > 0;
+}
+
+static void printUsage()
+{
+    cerr << "Usage: bench [options]\n";
+    cerr << "  --suite <alloc|cache|all>          targets to run (default all)\n";
+    cerr << "  --target <substring>               only targets whose name contains it\n";
+    cerr << "  --workload <uniform|zipf|stride|prodcons|all>\n";
+    cerr << "  --ops <n[,n...]>                   scales, with K/M/G suffixes (default 1M)\n";
+    cerr << "  --live <n>                         live blocks for allocator workloads (default 1024)\n";
+    cerr << "  --footprint <bytes>                address range for cache workloads (default 64M)\n";
+    cerr << "  --stride <bytes>                   stride workload step (default 256)\n";
+    cerr << "  --cache-config <file>              hierarchy for MultilevelCache\n";
+    cerr << "  --format <json|csv>                output format (default json)\n";
+    cerr << "  --seed <n>\n";
+}
+
+static bool parseOptions(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        string val = argv[++i];
+        if (arg == "--suite")
+            opt.suite = val;
+        else if (arg == "--target")
+            opt.target = val;
+        else if (arg == "--workload")
+            opt.workload = val;
+        else if (arg == "--ops")
+        {
+            opt.scales.clear();
+            stringstream ss(val);
+            string tok;
+            long long v;
+            while (getline(ss, tok, ','))
+            {
+                if (!parseScale(tok, v))
+                    return false;
+                opt.scales.push_back(v);
+            }
+        }
+        else if (arg == "--live")
+            opt.live = atoi(val.c_str());
+        else if (arg == "--footprint")
+        {
+            if (!parseScale(val, opt.footprint))
+                return false;
+        }
+        else if (arg == "--stride")
+            opt.stride = atoi(val.c_str());
+        else if (arg == "--cache-config")
+            opt.cacheConfig = val;
+        else if (arg == "--format")
+            opt.format = val;
+        else if (arg == "--seed")
+            opt.seed = strtoul(val.c_str(), nullptr, 10);
+        else
+            return false;
+    }
+    return (opt.format == "json" || opt.format == "csv") && opt.live > 0 && opt.stride > 0 && opt.footprint >= 128 &&
+           !opt.scales.empty();
+}
+
+static void printResult(const Options &opt, const Result &r, bool first)
+{
+    if (opt.format == "csv")
+    {
+        cout << r.target << ',' << r.workload << ',' << r.ops << ',' << r.nsPerOp << ',' << r.p50 << ',' << r.p90 << ',' << r.p99
+             << ',' << r.p999 << ',' << r.maxNs << ',' << r.timerNs << ',' << r.peakRssKb << ',';
+        if (r.failedAllocs >= 0)
+            cout << r.failedAllocs;
+        cout << ',';
+        if (r.hitRate >= 0)
+            cout << r.hitRate;
+        cout << '\n';
+        return;
+    }
+    cout << (first ? "" : ",\n") << "    {\"target\": \"" << r.target << "\", \"workload\": \"" << r.workload << "\", \"ops\": " << r.ops
+         << ", \"ns_per_op\": " << r.nsPerOp << ", \"p50_ns\": " << r.p50 << ", \"p90_ns\": " << r.p90 << ", \"p99_ns\": " << r.p99
+         << ", \"p999_ns\": " << r.p999 << ", \"max_ns\": " << r.maxNs << ", \"timer_ns\": " << r.timerNs
+         << ", \"peak_rss_kb\": " << r.peakRssKb;
+    if (r.failedAllocs >= 0)
+        cout << ", \"failed_allocs\": " << r.failedAllocs;
+    if (r.hitRate >= 0)
+        cout << ", \"hit_rate\": " << r.hitRate;
+    cout << "}";
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parseOptions(argc, argv, opt))
+    {
+        printUsage();
+        return 1;
+    }
+    double timer = timerOverhead();
+
+    // (target, workload) cases in output order
+    vector<pair<string, string>> cases;
+    auto wanted = [&](const string &target, const string &workload)
+    {
+        return target.find(opt.target) != string::npos && (opt.workload == "all" || opt.workload == workload);
+    };
+    vector<AllocTarget> allocs = allocTargets();
+    if (opt.suite == "all" || opt.suite == "alloc")
+        for (const AllocTarget &t : allocs)
+            for (const char *w : {"uniform", "zipf", "prodcons"})
+                if (wanted(t.name, w))
+                    cases.push_back({t.name, w});
+    if (opt.suite == "all" || opt.suite == "cache")
+        for (const char *t : {"Cache/fifo", "Cache/lru", "MultilevelCache"})
+            for (const char *w : {"uniform", "zipf", "stride", "prodcons"})
+                if (wanted(t, w))
+                    cases.push_back({t, w});
+    if (cases.empty())
+    {
+        cout << "No benchmark matches the given suite, target and workload\n";
+        return 1;
+    }
+
+    if (opt.format == "csv")
+        cout << "target,workload,ops,ns_per_op,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,timer_ns,peak_rss_kb,failed_allocs,hit_rate\n";
+    else
+        cout << "{\n  \"timer_ns\": " << timer << ",\n  \"benchmarks\": [\n";
+    bool first = true;
+    for (long long ops : opt.scales)
+    {
+        for (auto &c : cases)
+        {
+            Result r;
+            memset(&r, 0, sizeof(r));
+            snprintf(r.target, sizeof(r.target), "%s", c.first.c_str());
+            snprintf(r.workload, sizeof(r.workload), "%s", c.second.c_str());
+            r.ops = ops;
+            r.timerNs = timer;
+            bool ok = runCase([&](Result &res)
+                              {
+                                  for (const AllocTarget &t : allocs)
+                                      if (t.name == c.first)
+                                      {
+                                          benchAllocator(t, c.second, ops, opt, res);
+                                          return;
+                                      }
+                                  benchCache(c.first, c.second, ops, opt, res); },
+                              r);
+            if (!ok)
+            {
+                cerr << "Benchmark " << c.first << " " << c.second << " failed\n";
+                continue;
+            }
+            printResult(opt, r, first);
+            first = false;
+            cout.flush();
+        }
+    }
+    if (opt.format == "json")
+        cout << "\n  ]\n}\n";
+    return 0;
+}
@@ -0,0 +1,74 @@
+// Multi-threaded throughput of ConcurrentBuddy: every thread drives one
+// simulated CPU with a random mix of small allocations and frees.
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include "../include/ConcurrentBuddy.h"
+#include "thread_counts.h"
+
+using namespace std;
+using namespace std::chrono;
+
+static double run(int threads, int cachedOrders, long long opsPerThread)
+{
+    // Plenty of room so the run measures the allocator, not OOM handling
+    ConcurrentBuddy cb(1ULL << 32, threads, 6, cachedOrders, 64);
+    auto worker = [&](int cpu)
+    {
+        mt19937 rng(cpu + 1);
+        vector<pair<unsigned long long, unsigned long long>> held;
+        held.reserve(1024);
+        for (long long i = 0; i < opsPerThread; i++)
+        {
+            if (held.size() < 1024 && (held.size() < 64 || (rng() & 1)))
+            {
+                unsigned long long sz = 64ULL << (rng() % 4);
+                long long off = cb.access(cpu, sz);
+                if (off >= 0)
+                    held.push_back({(unsigned long long)off, sz});
+            }
+            else
+            {
+                size_t k = rng() % held.size();
+                cb.free(cpu, held[k].first, held[k].second);
+                held[k] = held.back();
+                held.pop_back();
+            }
+        }
+        for (auto &h : held)
+            cb.free(cpu, h.first, h.second);
+        cb.drain(cpu);
+    };
+
+    auto start = steady_clock::now();
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++)
+        pool.emplace_back(worker, t);
+    for (auto &t : pool)
+        t.join();
+    double secs = duration<double>(steady_clock::now() - start).count();
+    return threads * opsPerThread / secs / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    long long ops = argc > 1 ? atoll(argv[1]) : 2000000;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : (int)thread::hardware_concurrency();
+    if (maxThreads < 1)
+        maxThreads = 1;
+
+    cout << "threads,locked_mops,percpu_mops,speedup_vs_1\n";
+    double base = 0;
+    for (int t : threadCounts(maxThreads))
+    {
+        double locked = run(t, 0, ops);
+        double percpu = run(t, 4, ops);
+        if (t == 1)
+            base = percpu;
+        cout << t << "," << locked << "," << percpu << "," << percpu / base << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,51 @@
+// Throughput of set-sharded cache replay: one large LLC-sized cache replays
+// the same random trace with a growing number of worker threads.
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include "../include/Cache.h"
+#include "thread_counts.h"
+
+using namespace std;
+using namespace std::chrono;
+
+static double run(const vector<unsigned long long> &trace, int threads, long long &hits)
+{
+    // 32 MiB, 64-byte lines, 16 ways: 32K sets to spread over the workers
+    CacheT<LruPolicy> c(32 << 20, 64, 16);
+    auto start = steady_clock::now();
+    c.replay(trace, threads);
+    double secs = duration<double>(steady_clock::now() - start).count();
+    hits = c.getHits();
+    return trace.size() / secs / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    long long n = argc > 1 ? atoll(argv[1]) : 20000000;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : (int)thread::hardware_concurrency();
+    if (maxThreads < 1)
+        maxThreads = 1;
+
+    // Mostly a 64 MiB working set with a hot 4 MiB region, so both hits and
+    // evictions are exercised
+    mt19937_64 rng(42);
+    vector<unsigned long long> trace(n);
+    for (auto &a : trace)
+        a = (rng() % 4 == 0) ? rng() % (4 << 20) : rng() % (64 << 20);
+
+    cout << "threads,mops,speedup_vs_1,hits\n";
+    double base = 0;
+    for (int t : threadCounts(maxThreads))
+    {
+        long long hits;
+        double mops = run(trace, t, hits);
+        if (t == 1)
+            base = mops;
+        cout << t << "," << mops << "," << mops / base << "," << hits << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef THREAD_COUNTS_H
+#define THREAD_COUNTS_H
+#include <vector>
+using namespace std;
+
+// Thread counts a scaling benchmark steps through: the powers of two below
+// maxThreads, then maxThreads itself (1, 2, 4, 6 for a maximum of 6)
+inline vector<int> threadCounts(int maxThreads)
+{
+    vector<int> counts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxThreads);
+    return counts;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <string>
+#include <string_view>
+#include <streambuf>
+#include <vector>
+#include <charconv>
+#include "MappedFile.h"
+using namespace std;
+
+// One command line split into words. The words are views into the line, so
+// splitting allocates nothing; they are valid while the line is.
+struct CommandArgs
+{
+    static const int MAX_WORDS = 8;
+    string_view word[MAX_WORDS]; // word 0 is the command itself
+    int count;
+};
+
+// Splits [p, end) at spaces, tabs and carriage returns. Words past
+// MAX_WORDS are dropped.
+void splitCommand(const char *p, const char *end, CommandArgs &args);
+
+// Whole-word integer parse; false on an empty word, trailing characters or
+// overflow
+template <class T>
+bool parseArg(string_view s, T &v)
+{
+    auto res = from_chars(s.data(), s.data() + s.size(), v);
+    return res.ec == errc() && res.ptr == s.data() + s.size();
+}
+
+// Stream buffer that collects output in one large block and hands it to
+// write(2) only when the block fills or on flush. Installed as cout's buffer
+// in batch mode, it turns millions of small writes into a few large ones.
+class OutputBuffer : public streambuf
+{
+    vector<char> buf;
+    int fd;
+
+    bool drain();
+
+protected:
+    int_type overflow(int_type c) override;
+    streamsize xsputn(const char *s, streamsize n) override;
+    int sync() override;
+
+public:
+    OutputBuffer(int fd, size_t size = 1 << 20);
+    ~OutputBuffer();
+};
+
+#endif
@@ -3,30 +3,57 @@
 #include <vector>
 #include <iostream>
 using namespace std;
+
+// Buddy allocator over an arena of offsets [0, 2^mxord). All metadata lives
+// outside the arena, so blocks can be as small as one byte and the arena
+// itself is never touched. Metadata is indexed by minimum block (offset >>
+// mnord), so an arena holds fewer than 2^32 minimum blocks and NIL_BLOCK is
+// never a real index. It costs about 5 bytes per minimum block: 4 of list
+// links per buddy pair, the live-order byte and the pair bits.
 class Buddy
 {
-    struct Block
-    {
-        int ord;
-        Block *prev;
-        Block *next;
-    };
+    typedef unsigned long long u64;
+    static const unsigned NIL_BLOCK = ~0u;
+
     int mxord;
-    int size;
-    Block **blocks;
+    int mnord;
+    u64 size;
+    // Free lists per order, most recently freed first, threaded through
+    // per-pair link slots: a free block's links sit at (offset >> mnord) / 2.
+    unsigned freeHead[64];
+    unsigned *nextFree;
+    unsigned *prevFree;
+    u64 nonEmpty; // bit i set when order i's free list is non-empty
+    // One bit per buddy pair and order: set when exactly one of the two
+    // buddies is free at that order (the classic free_area map)
+    u64 *pairMap;
+    vector<u64> pairBase;
+    // Order + 1 at the first minimum block of every live allocation, 0
+    // everywhere else
+    unsigned char *liveOrder;
 
-    int getOrd(int sz);
-    void split(int ord);
-    void merge(Block *bl);
+    void togglePair(int ord, u64 off);
+    bool pairBit(int ord, u64 off) const;
 
-    Block *getBud(Block *bl);
-    void rem(Block *bl);
-    void add(Block *bl);
+    u64 pop(int ord);
+    void rem(int ord, u64 off);
+    void add(int ord, u64 off);
 
 public:
-    Buddy(int sz);
-    Block *access(int sz);
-    void free(void *bl);
+    // Throws invalid_argument unless 2^minOrd <= sz and sz holds fewer than
+    // 2^32 minimum blocks
+    Buddy(u64 sz, int minOrd = 0);
+    ~Buddy();
+    Buddy(const Buddy &) = delete;
+    Buddy &operator=(const Buddy &) = delete;
+
+    int getOrd(u64 sz);
+    long long access(u64 sz);
+    vector<u64> allocateN(int ord, int count);
+    bool free(u64 off);
+
+    int maxOrder() const { return mxord; }
+    int minOrder() const { return mnord; }
 };
 
-#endif
\ No newline at end of file
+#endif
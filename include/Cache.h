@@ -3,32 +3,103 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include "ReplacementPolicy.h"
+#include "Instrumentation.h"
 using namespace std;
 
-struct CacheLine{
-    bool valid;
-    int tag;
-    long long fifoTime;
-
-    CacheLine():valid(false),tag(0),fifoTime(0){}
+//Policy-independent view of a cache, used where the policy is only known at
+//run time (e.g. levels of a configured hierarchy). CacheT is final, so calls
+//made on a concrete CacheT never go through the vtable.
+class CacheBase{
+   public:
+   virtual ~CacheBase(){}
+   //Lookup that fills the block on a miss
+   virtual bool access(unsigned long long addr)=0;
+   //Lookup without filling on a miss
+   virtual bool lookup(unsigned long long addr)=0;
+   //Places addr's block (which must not be resident), dirty or clean; returns
+   //true and describes the evicted block if a valid line was replaced
+   virtual bool fill(unsigned long long addr,bool dirty,unsigned long long& victim,bool& victimDirty)=0;
+   //Residency check that touches neither counters nor policy state
+   virtual bool contains(unsigned long long addr) const=0;
+   virtual bool setDirty(unsigned long long addr)=0;
+   virtual bool invalidate(unsigned long long addr,bool& wasDirty)=0;
+   virtual void stats(const string& name) const=0;
+   virtual int getBlockSize() const=0;
+   virtual const char* policyName() const=0;
+#ifdef MEMSIM_INSTRUMENT
+   virtual void missHeatmap(const string& name) const=0;
+#endif
 };
 
-class Cache{
+//Set-major structure-of-arrays layout: way w of set s lives at index
+//s*associativity+w in tags, and bit w of validMask[s] says whether it holds a
+//line; dirtyMask[s] marks lines modified since they were filled.
+//Associativity is limited to 64 ways (one mask word per set).
+//
+//The replacement policy is a template parameter so its hooks inline into the
+//lookup; CacheT is explicitly instantiated for every policy in
+//ReplacementPolicy.h.
+template<class Policy>
+class CacheT final:public CacheBase{
    private:
    int size;
    int blockSize;
    int associativity;
    int setnum;
    long long time;
-   int hits;
-   int misses;
+   long long hits;
+   long long misses;
 
-   vector<vector<CacheLine>> sets;
+   vector<unsigned long long> tags;
+   vector<unsigned long long> validMask;
+   vector<unsigned long long> dirtyMask;
+   Policy repl;
+#ifdef MEMSIM_INSTRUMENT
+   SetHeatmap heat;
+#endif
+
+   void locate(unsigned long long addr,int& setIdx,unsigned long long& tag) const;
+   unsigned long long hitMask(int setIdx,unsigned long long tag) const;
+   bool place(int setIdx,unsigned long long tag,bool dirty,unsigned long long& oldTag,bool& oldDirty,long long now);
+   bool touch(int setIdx,unsigned long long tag,long long now);
+   void replayShards(const unsigned long long* trace,size_t n,int threads);
 
    public:
-   Cache(int size,int blockSize,int associativity);
-   bool access(int addr);
-   void stats(const string& name) const;
+   CacheT(int size,int blockSize,int associativity);
+   bool access(unsigned long long addr) override;
+   bool lookup(unsigned long long addr) override;
+   bool fill(unsigned long long addr,bool dirty,unsigned long long& victim,bool& victimDirty) override;
+   bool contains(unsigned long long addr) const override;
+   bool setDirty(unsigned long long addr) override;
+   bool invalidate(unsigned long long addr,bool& wasDirty) override;
+   void stats(const string& name) const override;
+   //Runs trace through access(). With threads>1 the sets are split into that
+   //many contiguous ranges, each owned by one worker thread with its own
+   //counters. Access i still sees now=time+i+1, so the result is identical
+   //to a serial replay for every policy.
+   void replay(const vector<unsigned long long>& trace,int threads=1);
+
+   Policy& policy(){return repl;}
+   int getBlockSize() const override{return blockSize;}
+   const char* policyName() const override{return Policy::name();}
+   long long getHits() const{return hits;}
+   long long getMisses() const{return misses;}
+#ifdef MEMSIM_INSTRUMENT
+   void missHeatmap(const string& name) const override{heat.print(cout,name);}
+#endif
 };
 
-#endif
\ No newline at end of file
+typedef CacheT<FifoPolicy> Cache;
+
+//Builds a cache for a policy given by name (fifo, lru, plru, srrip, brrip,
+//random); nullptr for unknown names. OPT needs a prepared trace and is not
+//available here.
+unique_ptr<CacheBase> makeCache(const string& policy,int size,int blockSize,int assoc);
+
+//Replays trace through one cache per replacement policy with the same
+//geometry and prints each policy's stats
+void comparePolicies(const vector<unsigned long long>& trace,int size,int blockSize,int assoc,int threads=1);
+
+#endif
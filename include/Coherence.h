@@ -0,0 +1,110 @@
+#ifndef COHERENCE_H
+#define COHERENCE_H
+
+#include "MultilevelCache.h"
+#include <unordered_map>
+
+//MESI state of a block in one core's private caches; absent means Invalid
+enum MesiState{MESI_I,MESI_S,MESI_E,MESI_M};
+
+//Why a private miss happened. A coherence miss is a miss on a block the core
+//lost to another core's write. It is true sharing if one of the words written
+//remotely since then is the word being accessed now, false sharing otherwise.
+enum MissKind{MISS_OTHER,MISS_TRUE_SHARING,MISS_FALSE_SHARING};
+
+//Every level of cfg but the last becomes private to each core and the last is
+//shared. Coherence is tracked per block, so all levels need one block size.
+bool checkCoherenceConfig(const HierarchyConfig& cfg,int cores,string& err);
+
+//N cores with private caches kept coherent by MESI through a full-map
+//directory that sits beside the shared last-level cache (LLC).
+//
+//Within a core the private levels are inclusive, so a block is in the core's
+//caches exactly when it is in its last private level; the directory's sharer
+//mask tracks that. An inclusive LLC additionally back-invalidates private
+//copies of its victims.
+//
+//replay() runs an epoch of the trace on several host threads when no block in
+//it is touched by two cores or held by a core other than the one touching it.
+//Each core then only ever sees E/M grants and silent upgrades, so its private
+//caches are simulated in parallel. The directory and LLC work they produce is
+//applied afterwards in trace order, which gives the same result as a serial
+//run. Other epochs, and every epoch under an inclusive LLC, run serially.
+class CoherentSystem{
+    struct Event{
+        long long idx;
+        unsigned long long block;
+        unsigned char kind;    //EV_MISS, EV_UPGRADE or EV_EVICT
+        bool write;            //EV_MISS: write miss; EV_EVICT: dirty
+        unsigned char miss;    //EV_MISS: MissKind
+        int word;
+    };
+    struct Core{
+        vector<unique_ptr<CacheBase>> levels;
+        unordered_map<unsigned long long,unsigned char> state;
+        //Blocks lost to remote writes -> words written remotely since
+        unordered_map<unsigned long long,unsigned long long> lostWords;
+        vector<Event> events;   //directory/LLC work deferred by a parallel epoch
+        vector<long long> hits,misses;
+        long long accesses=0;
+        long long cycles=0;
+        long long upgrades=0;
+        long long trueSharing=0;
+        long long falseSharing=0;
+        long long invalidationsReceived=0;
+        long long writebacks=0;
+    };
+    struct DirEntry{
+        unsigned long long sharers=0;   //cores holding the block
+        unsigned long long lost=0;      //cores that lost it to a remote write
+        int owner=-1;                   //core holding it E or M
+    };
+    struct LineStats{
+        long long invalidations=0;
+        long long trueSharing=0;
+        long long falseSharing=0;
+    };
+
+    vector<CacheLevelConfig> cfgs;   //private levels, then the LLC
+    vector<Core> cores;
+    unique_ptr<CacheBase> llc;
+    unordered_map<unsigned long long,DirEntry> dir;
+    unordered_map<unsigned long long,LineStats> lines;
+    int blockSize;
+    int wordSize;
+    int memoryLatency;
+    long long llcHits=0,llcMisses=0;
+    long long sharedCycles=0;
+    long long invalidations=0;
+    long long cacheToCache=0;
+    long long llcBackInvalidations=0;
+    long long memWrites=0;
+    long long badCores=0;
+    long long epochs=0,parallelEpochs=0;
+
+    void access(int core,unsigned long long addr,bool write,long long idx,bool local);
+    void privateFill(int core,int level,unsigned long long addr,bool local,long long idx);
+    void dropPrivate(int core,unsigned long long block);
+    MesiState request(int core,unsigned long long block,bool write,bool upgrade,int word,MissKind kind);
+    void release(int core,unsigned long long block,bool dirty);
+    void invalidateRemote(int core,unsigned long long block,int word);
+    void noteWrite(int core,unsigned long long block,int word);
+    void writeBack(unsigned long long block);
+    bool independent(const vector<TraceRecord>& recs) const;
+    void runParallel(const vector<TraceRecord>& recs,long long base,int threads);
+
+    public:
+    CoherentSystem(const HierarchyConfig& cfg,int cores);
+
+    //Replays a trace whose records carry core ids, using up to threads host
+    //threads; returns the number of records replayed
+    long long replay(TraceReader& trace,int threads);
+    int coreCount() const{return cores.size();}
+    //State of the block holding addr in core's private caches
+    MesiState state(int core,unsigned long long addr) const;
+    long long getInvalidations() const{return invalidations;}
+    long long getParallelEpochs() const{return parallelEpochs;}
+    void stats();
+};
+
+#endif
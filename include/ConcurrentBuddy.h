@@ -0,0 +1,55 @@
+#ifndef CONCURRENT_BUDDY_H
+#define CONCURRENT_BUDDY_H
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include "Buddy.h"
+using namespace std;
+
+// Buddy allocator shared by several simulated CPUs, in the style of a kernel
+// page allocator: each CPU keeps small-order blocks in a private cache and only
+// takes the zone lock to refill or drain a whole batch at once.
+//
+// A CPU's cache must only be used by the thread driving that CPU. Every block
+// handed out is marked with its order in a per-block byte, and a free must
+// clear the mark with the order its size implies. Double frees and frees with
+// the wrong size are rejected before they can reach a CPU cache, without
+// taking the lock.
+class ConcurrentBuddy
+{
+    typedef unsigned long long u64;
+
+    struct alignas(64) CpuCache
+    {
+        vector<vector<u64>> lists; // one stack per cached order
+    };
+
+    Buddy area;
+    mutex lock;
+    vector<CpuCache> caches;
+    // Order + 1 of the block handed out at each minimum block, 0 if none
+    vector<atomic<unsigned char>> handedOut;
+    int cachedOrders;
+    int batch;
+    atomic<long long> refills;
+    atomic<long long> drains;
+    atomic<long long> invalidFrees;
+
+    void drainList(vector<u64> &list, size_t keep);
+
+public:
+    ConcurrentBuddy(u64 sz, int cpus, int minOrd = 0, int cachedOrders = 4, int batch = 32);
+
+    long long access(int cpu, u64 sz);
+    // False, counted as an invalid free, unless off was handed out for a
+    // request of sz's order and not freed since
+    bool free(int cpu, u64 off, u64 sz);
+    void drain(int cpu);
+
+    int cpus() const { return caches.size(); }
+    long long refillCount() const { return refills; }
+    long long drainCount() const { return drains; }
+    long long invalidFreeCount() const { return invalidFrees; }
+};
+
+#endif
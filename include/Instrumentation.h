@@ -0,0 +1,142 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+#include <iostream>
+#include <string>
+using namespace std;
+
+// Compile-time instrumentation. Built with -DMEMSIM_INSTRUMENT (make
+// INSTRUMENT=1), the allocators count and time every operation into 64-bit
+// counters and log2 histograms, caches keep a miss count per set, and every
+// timed operation lands in a ring buffer that exports as Chrome trace JSON
+// (which Perfetto also opens). Without it the MEMSIM_* macros expand to
+// nothing and none of the types below exist, so the hot paths are unchanged.
+
+// Counters and histograms, as (id, name). Names are what reports and traces
+// show.
+#define MEMSIM_COUNTERS(X)                    \
+    X(PM_ALLOC, "pm.alloc")                   \
+    X(PM_ALLOC_FAIL, "pm.alloc_fail")         \
+    X(PM_FREE, "pm.free")                     \
+    X(BUDDY_ALLOC, "buddy.alloc")             \
+    X(BUDDY_ALLOC_FAIL, "buddy.alloc_fail")   \
+    X(BUDDY_FREE, "buddy.free")               \
+    X(SLAB_ALLOC, "slab.alloc")               \
+    X(SLAB_ALLOC_FAIL, "slab.alloc_fail")     \
+    X(SLAB_FREE, "slab.free")
+
+#define MEMSIM_HISTOGRAMS(X)                  \
+    X(PM_ALLOC_NS, "pm.alloc_ns")             \
+    X(PM_FREE_NS, "pm.free_ns")               \
+    X(PM_ALLOC_BYTES, "pm.alloc_bytes")       \
+    X(BUDDY_ALLOC_NS, "buddy.alloc_ns")       \
+    X(BUDDY_FREE_NS, "buddy.free_ns")         \
+    X(BUDDY_ALLOC_BYTES, "buddy.alloc_bytes") \
+    X(SLAB_ALLOC_NS, "slab.alloc_ns")         \
+    X(SLAB_FREE_NS, "slab.free_ns")           \
+    X(SLAB_ALLOC_BYTES, "slab.alloc_bytes")
+
+// Always available; without MEMSIM_INSTRUMENT they report that
+// instrumentation is compiled out
+bool instrumentEnabled();
+void instrumentReport(ostream &out);
+void instrumentReset();
+// Writes the buffered events as Chrome trace JSON; false if the file cannot
+// be written or instrumentation is compiled out
+bool exportChromeTrace(const string &path);
+
+#ifdef MEMSIM_INSTRUMENT
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+#define MEMSIM_ID(id, name) id,
+enum InstrCounter
+{
+    MEMSIM_COUNTERS(MEMSIM_ID) INSTR_COUNTERS
+};
+enum InstrHistogram
+{
+    MEMSIM_HISTOGRAMS(MEMSIM_ID) INSTR_HISTOGRAMS
+};
+#undef MEMSIM_ID
+
+// Bucket b counts values in [2^(b-1), 2^b); bucket 0 counts zeros. Relaxed
+// atomics, since allocators on several threads share one histogram.
+class LogHistogram
+{
+    atomic<uint64_t> buckets[65];
+    atomic<uint64_t> total, sum, maxValue;
+
+public:
+    LogHistogram() { reset(); }
+    void add(uint64_t v)
+    {
+        buckets[v ? 64 - __builtin_clzll(v) : 0].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        sum.fetch_add(v, memory_order_relaxed);
+        uint64_t m = maxValue.load(memory_order_relaxed);
+        while (v > m && !maxValue.compare_exchange_weak(m, v, memory_order_relaxed))
+            ;
+    }
+    uint64_t count() const { return total.load(memory_order_relaxed); }
+    void reset();
+    void print(ostream &out, const char *name) const;
+};
+
+// Misses per set of one cache. A set is only ever touched by one thread (a
+// sharded replay gives each worker whole sets), so the counts are plain.
+class SetHeatmap
+{
+    vector<uint64_t> misses;
+
+public:
+    void resize(int sets) { misses.assign(sets, 0); }
+    void miss(int set) { misses[set]++; }
+    // One row of up to 64 cells, each the misses of a run of sets scaled to
+    // the hottest cell, then the hottest individual sets
+    void print(ostream &out, const string &name) const;
+};
+
+extern atomic<uint64_t> instrCounters[INSTR_COUNTERS];
+extern LogHistogram instrHistograms[INSTR_HISTOGRAMS];
+
+uint64_t instrNow(); // ns since the first call
+// Appends a complete event to the ring buffer, overwriting the oldest once it
+// is full. Lock-free: writers claim slots with one fetch_add.
+void recordEvent(const char *name, const char *cat, uint64_t start, uint64_t dur, const char *argName, uint64_t arg);
+
+// Times its scope into a histogram and the event ring; the event carries
+// one named argument (the size of an allocation, the offset of a free)
+class InstrScope
+{
+    const char *name;
+    const char *cat;
+    InstrHistogram hist;
+    const char *argName;
+    uint64_t arg;
+    uint64_t start;
+
+public:
+    InstrScope(const char *name, const char *cat, InstrHistogram hist, const char *argName, uint64_t arg)
+        : name(name), cat(cat), hist(hist), argName(argName), arg(arg), start(instrNow()) {}
+    ~InstrScope()
+    {
+        uint64_t dur = instrNow() - start;
+        instrHistograms[hist].add(dur);
+        recordEvent(name, cat, start, dur, argName, arg);
+    }
+};
+
+#define MEMSIM_COUNT(id) instrCounters[id].fetch_add(1, memory_order_relaxed)
+#define MEMSIM_HIST(id, v) instrHistograms[id].add(v)
+#define MEMSIM_SCOPE(name, cat, hist, argName, arg) InstrScope memsimScope_(name, cat, hist, argName, arg)
+#define MEMSIM_SET_MISS(heatmap, set) (heatmap).miss(set)
+#else
+#define MEMSIM_COUNT(id) ((void)0)
+#define MEMSIM_HIST(id, v) ((void)0)
+#define MEMSIM_SCOPE(name, cat, hist, argName, arg) ((void)0)
+#define MEMSIM_SET_MISS(heatmap, set) ((void)0)
+#endif
+
+#endif
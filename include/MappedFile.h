@@ -0,0 +1,25 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <string>
+using namespace std;
+
+// Read-only memory mapping of a whole file, read front to back
+class MappedFile
+{
+    const char *data;
+    size_t len;
+    bool ok;
+
+public:
+    MappedFile(const string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool good() const { return ok; }
+    const char *begin() const { return data; }
+    const char *end() const { return data + len; }
+    size_t size() const { return len; }
+};
+
+#endif
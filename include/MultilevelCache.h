@@ -2,22 +2,110 @@
 #define MULTILEVEL_CACHE_H
 
 #include "Cache.h"
+#include "Trace.h"
+#include "Prefetcher.h"
+#include <unordered_map>
+#include <unordered_set>
+
+//How a level relates to the levels above it (closer to the CPU):
+//  INCLUSIVE  holds everything above it; its evictions back-invalidate them
+//  EXCLUSIVE  holds only what was evicted from the level above (victim cache);
+//             a hit moves the block up and out of this level
+//  NINE       non-inclusive non-exclusive: filled on demand, evicts freely
+enum Inclusion{INCLUSIVE,EXCLUSIVE,NINE};
+
+//Write handling of a level:
+//  write-back     writes dirty the resident line; it goes down when evicted
+//  write-through  every write is forwarded to the next level at once
+//  write-allocate / no-write-allocate  whether a write miss fills the level
+//  writeBuffer    entries of a coalescing buffer (per block) between this
+//                 level and the next; 0 sends traffic straight down
+//
+//prefetch names the level's prefetcher (see Prefetcher.h), empty for none.
+struct CacheLevelConfig{
+    string name;
+    int size;
+    int blockSize;
+    int assoc;
+    string policy;
+    int latency;
+    Inclusion inclusion;
+    bool writeBack=true;
+    bool writeAllocate=true;
+    int writeBuffer=0;
+    string prefetch="";
+    int prefetchDegree=1;
+    int prefetchDistance=1;
+};
+
+struct HierarchyConfig{
+    vector<CacheLevelConfig> levels;
+    int memoryLatency;
+    int writeSize=4;   //bytes carried by one CPU store
+};
+
+//The two-level FIFO hierarchy the simulator has always used
+HierarchyConfig defaultHierarchyConfig();
+//Reads a hierarchy description (see configs/cache_hierarchy.cfg). Returns
+//false and sets err on malformed input.
+bool loadHierarchyConfig(const string& path,HierarchyConfig& cfg,string& err);
 
 class MultilevelCache{
-    Cache L1;
-    Cache L2;
+    struct Level{
+        unique_ptr<CacheBase> cache;
+        CacheLevelConfig cfg;
+        long long hits=0;
+        long long misses=0;
+        long long dirtyEvictions=0;
+        long long bytesIn=0;    //fills brought up from below
+        long long bytesOut=0;   //write-backs, write-throughs and victims sent down
+        long long coalesced=0;  //writes merged into a pending buffer entry
+        vector<pair<unsigned long long,int>> buffer;   //block, bytes; oldest first
+        unique_ptr<Prefetcher> prefetcher;
+        //Prefetched blocks not yet used -> cycle their data arrives
+        unordered_map<unsigned long long,long long> pending;
+        //Demand blocks a prefetch evicted; a miss on one is pollution
+        unordered_set<unsigned long long> displaced;
+        long long pfIssued=0,pfUseful=0,pfLate=0,pfUnused=0,pfPolluting=0;
+    };
+    vector<Level> levels;
+    int memoryLatency;
+    int writeSize;
+    long long accesses=0;
+    long long writes=0;
+    long long cycles=0;
+    long long memReadBytes=0;
+    long long memWriteBytes=0;
+    vector<unsigned long long> pfCands;
 
-    int l1_hit=0;
-    int l1_miss=0;
-    int l2_hit=0;
-    int l2_miss=0;
+    bool dropLine(int level,unsigned long long addr,bool& dirty);
+    bool backInvalidate(int level,unsigned long long victim);
+    void insertVictim(int level,unsigned long long victim,bool dirty);
+    void evicted(int level,unsigned long long victim,bool dirty);
+    void fillLevel(int level,unsigned long long addr,bool prefetch=false);
+    void prefetch(int level,unsigned long long addr);
+    void sendDown(int level,unsigned long long addr,int bytes);
+    void deliver(int level,unsigned long long addr,int bytes);
 
     public:
-    MultilevelCache(Cache& l1,Cache& l2);
+    MultilevelCache(const HierarchyConfig& cfg);
 
-    void access(int addr);
+    //Level that served addr (levels.size() for memory). Updates the
+    //hierarchy and its counters but prints nothing.
+    int lookup(unsigned long long addr,bool write=false,unsigned long long pc=0);
+    void access(unsigned long long addr,bool write=false);
+    //Streams a whole trace through the hierarchy without per-access output
+    //and returns the number of accesses replayed
+    long long replay(TraceReader& trace);
 
+    int levelCount() const{return levels.size();}
+    //Cycles spent by all accesses so far
+    long long getCycles() const{return cycles;}
     void cacheStats();
+#ifdef MEMSIM_INSTRUMENT
+    //Misses per set of every level
+    void missHeatmaps() const;
+#endif
 };
 
-#endif
\ No newline at end of file
+#endif
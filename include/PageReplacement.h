@@ -0,0 +1,171 @@
+#ifndef PAGE_REPLACEMENT_H
+#define PAGE_REPLACEMENT_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <queue>
+using namespace std;
+
+//Page replacement over a page-granular reference string. Pages are first
+//renumbered to dense ids 0..pages-1 (densePages()), so every policy keeps
+//its state in flat arrays indexed by id and each reference costs O(1)
+//(amortised for the clock variants; O(log n) for OPT's heap).
+class PageReplacer{
+    public:
+    virtual ~PageReplacer(){}
+    //References page id; true on a hit, false on a page fault
+    virtual bool access(int id)=0;
+    virtual const char* name() const=0;
+};
+
+//Intrusive doubly linked lists over ids, with one sentinel per list; an id
+//is in at most one list at a time
+struct IdLists{
+    vector<int> prev,next;
+    int base;
+
+    void init(int ids,int lists);
+    void pushFront(int list,int id);
+    void remove(int id);
+    //Least recently pushed id of list, or sentinel(list) if it is empty
+    int back(int list) const{return prev[base+list];}
+    int sentinel(int list) const{return base+list;}
+};
+
+class FifoReplacer:public PageReplacer{
+    int frames;
+    vector<int> ring;   //resident ids in load order, from head
+    int head=0;
+    int used=0;
+    vector<char> resident;
+
+    public:
+    FifoReplacer(int frames,int pages);
+    bool access(int id) override;
+    const char* name() const override{return "FIFO";}
+};
+
+class LruReplacer:public PageReplacer{
+    int frames;
+    int used=0;
+    IdLists list;
+    vector<char> resident;
+
+    public:
+    LruReplacer(int frames,int pages);
+    bool access(int id) override;
+    const char* name() const override{return "LRU";}
+};
+
+//Second chance: the hand clears reference bits until it finds a page
+//without one
+class ClockReplacer:public PageReplacer{
+    int frames;
+    vector<int> slots;
+    int hand=0;
+    int used=0;
+    vector<char> resident;
+    vector<char> ref;
+
+    public:
+    ClockReplacer(int frames,int pages);
+    bool access(int id) override;
+    const char* name() const override{return "Clock";}
+};
+
+//CLOCK-Pro (Jiang, Chen and Zhang, USENIX ATC 2005). Resident pages are hot
+//or cold. A new cold page starts a test period; if it is evicted during it,
+//it stays on the clock as a non-resident test page. A fault on a test page
+//means its reuse distance beats some hot page's, so it comes back hot and
+//the cold target memCold grows; test periods that end unused shrink it.
+//Three hands sweep one circular list: hand cold evicts, hand hot demotes
+//unreferenced hot pages, and hand test retires old test pages. Every hand
+//loop stops at the first page it can act on, so the work per fault is
+//amortised O(1).
+class ClockProReplacer:public PageReplacer{
+    enum Type{NONE,HOT,COLD,TEST};
+    int memMax;
+    int memCold;   //target number of cold pages, 1..memMax
+    int countHot=0,countCold=0,countTest=0;
+    vector<int> prev,next;
+    vector<char> type;
+    vector<char> ref;
+    vector<char> test;   //cold page in its test period
+    int handHot=-1,handCold=-1,handTest=-1;
+
+    void add(int id);
+    void del(int id);
+    void endTest(int id);
+    void runHandCold();
+    void runHandHot();
+    void runHandTest();
+
+    public:
+    ClockProReplacer(int frames,int pages);
+    bool access(int id) override;
+    const char* name() const override{return "Clock-Pro";}
+};
+
+//ARC (Megiddo and Modha, FAST 2003): T1/T2 hold pages seen once/more than
+//once, B1/B2 the ghosts of their recent evictions, and the T1 target p moves
+//towards whichever side's ghosts are being hit
+class ArcReplacer:public PageReplacer{
+    enum List{T1,T2,B1,B2,LISTS};
+    int c;
+    int p=0;
+    IdLists lists;
+    vector<char> where;   //list+1, 0 when the id is in none
+    int size[LISTS]={0,0,0,0};
+
+    void move(int id,int list);
+    void drop(int id);
+    void replace(bool inB2);
+
+    public:
+    ArcReplacer(int frames,int pages);
+    bool access(int id) override;
+    const char* name() const override{return "ARC";}
+};
+
+//Belady's OPT: evicts the resident page whose next use is furthest away.
+//nextUse[i] is the position of the next reference to the page referenced at
+//i, from nextUseIndex(); access() must be fed that same reference string.
+class OptReplacer:public PageReplacer{
+    int frames;
+    int used=0;
+    long long pos=0;
+    const vector<long long>& nextUse;
+    vector<long long> due;   //next use of each resident id, -1 if not resident
+    priority_queue<pair<long long,int>> heap;   //(next use, id), stale entries skipped
+
+    public:
+    OptReplacer(int frames,int pages,const vector<long long>& nextUse);
+    bool access(int id) override;
+    const char* name() const override{return "OPT";}
+};
+
+//Renumbers pages to dense ids in order of first reference; returns the
+//number of distinct pages
+int densePages(const vector<unsigned long long>& pages,vector<int>& ids);
+vector<long long> nextUseIndex(const vector<int>& ids,int pages);
+
+//Builds a replacer by name (fifo, lru, clock, clockpro, arc, opt); nullptr
+//for unknown names. nextUse is only used by opt.
+unique_ptr<PageReplacer> makeReplacer(const string& name,int frames,int pages,const vector<long long>& nextUse);
+
+//Denning's working set W(t,window): distinct pages among the last window
+//references, sampled at samples evenly spaced times
+struct WorkingSet{
+    vector<pair<long long,long long>> samples;   //(t, |W|)
+    double average;
+    long long peak;
+};
+WorkingSet workingSet(const vector<int>& ids,int pages,long long window,int samples);
+
+//Replays the references through every policy at every power-of-two frame
+//count from minFrames to maxFrames, spreading the runs over threads, and
+//prints the fault curves as CSV followed by the working-set series
+void comparePageReplacement(const vector<unsigned long long>& pages,int minFrames,int maxFrames,long long window,int threads=1);
+
+#endif
@@ -3,27 +3,78 @@
 
 #include <iostream>
 #include <vector>
+#include <set>
+#include "PoolAllocator.h"
 using namespace std;
 
+const int NIL=-1;
+
+//Block metadata lives in PhysicalMemory::blocks; links are pool indices
 struct Block{
     int start;
     int size;
     bool free;
-    Block* next;
-    Block* prev;
+    int next;
+    int prev;
 };
 
+enum FreeResult{FREE_OK,FREE_INVALID,FREE_DOUBLE};
+
+//A free remainder smaller than this stays part of the block it was split
+//from: a sliver that small fits almost no request and only lengthens the
+//free lists. The extra bytes count as internal fragmentation.
+const int MIN_SPLIT=8;
+
+//TLSF index geometry: first level = power of two, second level splits each
+//power-of-two range into TLSF_SL_COUNT equal classes
+const int TLSF_SL_LOG2=4;
+const int TLSF_SL_COUNT=1<<TLSF_SL_LOG2;
+const int TLSF_FL_COUNT=32-TLSF_SL_LOG2;
+
 class PhysicalMemory{
     private:
     int size;
-    int allocRequests;
-    int allocSuccess;
-    int allocFailure;
-    Block* head;
+    long long allocRequests;
+    long long allocSuccess;
+    long long allocFailure;
+    int head;
+    int freeSlot; //recycled pool entries, chained through next
     vector<char> memory;
     vector<Block> blocks;
+    //Free blocks ordered by (size,start), for best and worst fit. It is
+    //built in one pass by the first best or worst fit and kept up to date
+    //from then on, so instances that only use first fit or TLSF never pay
+    //for it and mixed workloads never rebuild it.
+    set<pair<int,int>,less<pair<int,int>>,PoolAllocator<pair<int,int>>> freeBySize;
+    bool sizeIndexed;
+    //Boundary tags: block starting at each address. Addresses that were
+    //freed and have since merged into a free block hold a freed mark
+    //instead, chained in address order into the list of that free block
+    //(markHead/markTail), so handing out the block clears exactly the marks
+    //it covers and a second free of them is told apart from a bad address.
+    vector<int> blockAt;
+    vector<int> markHead,markTail; //parallel to blocks
+    vector<char> startFreed; //parallel to blocks: a free block's own start was freed
+    vector<int> requested; //parallel to blocks: bytes asked for by a used block
+    //TLSF segregated free lists (Masmano et al., ECRTS 2004): every free
+    //block is also on the list of its (fl,sl) class, linked through
+    //freeNext/freePrev (parallel to blocks, so Block keeps its layout). A
+    //bit per non-empty class and per non-empty first level finds the
+    //smallest usable class in two find-first-set operations.
+    unsigned flBitmap;
+    unsigned slBitmap[TLSF_FL_COUNT];
+    int freeHead[TLSF_FL_COUNT][TLSF_SL_COUNT];
+    vector<int> freeNext,freePrev;
     
-    int allocate(Block* cur,int reqSize);
+    int newBlock(int start,int size,int next,int prev);
+    void releaseBlock(int idx);
+    void absorb(int dst,int src);
+    int allocate(int cur,int reqSize);
+    int smallestFit(int reqSize);
+    void insertFree(int idx);
+    void removeFree(int idx);
+    int tlsfFind(int reqSize);
+    void indexBySize();
 
     public:
 
@@ -32,11 +83,14 @@ class PhysicalMemory{
     int allocateFirstFit(int reqSize);
     int allocateBestFit(int reqSize);
     int allocateWorstFit(int reqSize);
+    //O(1) good fit: the first block of the smallest class whose every block
+    //fits, so a search never walks a list
+    int allocateTlsf(int reqSize);
 
-    void freeMem(int st);
+    FreeResult freeMem(int st);
 
     void dump();
     void stats();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,46 @@
+#ifndef POOL_ALLOCATOR_H
+#define POOL_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+
+//Recycles single-object allocations (tree/hash nodes) through a per-thread
+//freelist so that container churn never reaches the host malloc.
+template<class T>
+struct PoolAllocator{
+    using value_type=T;
+
+    PoolAllocator()=default;
+    template<class U> PoolAllocator(const PoolAllocator<U>&){}
+
+    T* allocate(size_t n){
+        if(n==1 && freeList){
+            Node* node=freeList;
+            freeList=node->next;
+            return reinterpret_cast<T*>(node);
+        }
+        size_t bytes=(n==1 && sizeof(T)<sizeof(Node))?sizeof(Node):n*sizeof(T);
+        return static_cast<T*>(::operator new(bytes));
+    }
+    void deallocate(T* p,size_t n){
+        if(n!=1){
+            ::operator delete(p);
+            return;
+        }
+        Node* node=reinterpret_cast<Node*>(p);
+        node->next=freeList;
+        freeList=node;
+    }
+
+    template<class U> bool operator==(const PoolAllocator<U>&) const{return true;}
+    template<class U> bool operator!=(const PoolAllocator<U>&) const{return false;}
+
+    private:
+    struct Node{Node* next;};
+    static thread_local Node* freeList;
+};
+
+template<class T>
+thread_local typename PoolAllocator<T>::Node* PoolAllocator<T>::freeList=nullptr;
+
+#endif
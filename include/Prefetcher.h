@@ -0,0 +1,86 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <vector>
+#include <string>
+#include <memory>
+using namespace std;
+
+//A hardware prefetcher attached to one cache level. It watches the demand
+//accesses that reach the level and proposes block addresses to bring in
+//ahead of use:
+//  degree    blocks proposed per trigger
+//  distance  how far ahead (in blocks, or strides) the first one lies
+class Prefetcher{
+    public:
+    virtual ~Prefetcher(){}
+    //A demand access to addr (issued by instruction pc, 0 if unknown) hit or
+    //missed this level; appends the addresses to prefetch to out
+    virtual void observe(unsigned long long addr,unsigned long long pc,bool hit,vector<unsigned long long>& out)=0;
+    virtual const char* name() const=0;
+};
+
+//On every miss to block b: b+distance .. b+distance+degree-1
+class NextLinePrefetcher:public Prefetcher{
+    int blockSize,degree,distance;
+
+    public:
+    NextLinePrefetcher(int blockSize,int degree,int distance);
+    void observe(unsigned long long addr,unsigned long long pc,bool hit,vector<unsigned long long>& out) override;
+    const char* name() const override{return "next-line";}
+};
+
+//Reference prediction table indexed by pc, or by 4 KiB region when the
+//trace carries no pc. An entry that sees the same non-zero stride twice in a
+//row prefetches addr+stride*(distance..distance+degree-1) on every access.
+class StridePrefetcher:public Prefetcher{
+    struct Entry{
+        unsigned long long key;
+        unsigned long long last;
+        long long stride;
+        int confidence;
+        bool valid;
+    };
+    static const int TABLE=256;
+    static const int REGION_SHIFT=12;
+    int blockSize,degree,distance;
+    vector<Entry> table;
+
+    public:
+    StridePrefetcher(int blockSize,int degree,int distance);
+    void observe(unsigned long long addr,unsigned long long pc,bool hit,vector<unsigned long long>& out) override;
+    const char* name() const override{return "stride";}
+};
+
+//Stream buffers in the style of Jouppi's: a small set of streams, each
+//allocated by a miss next to a recent miss (ascending or descending) and
+//advanced when a miss lands in its window. An active stream keeps its head
+//distance blocks ahead of the demand stream, degree blocks per advance.
+//Prefetched blocks are placed in the cache itself rather than in a side
+//buffer, so the cache stats see them.
+class StreamPrefetcher:public Prefetcher{
+    struct Stream{
+        unsigned long long next;   //next block the demand stream should reach
+        unsigned long long head;   //next block to prefetch
+        int dir;
+        long long lastUse;
+        bool valid;
+    };
+    static const int STREAMS=8;
+    static const int HISTORY=16;
+    int blockSize,degree,distance;
+    vector<Stream> streams;
+    vector<unsigned long long> recentMisses;
+    long long tick=0;
+
+    public:
+    StreamPrefetcher(int blockSize,int degree,int distance);
+    void observe(unsigned long long addr,unsigned long long pc,bool hit,vector<unsigned long long>& out) override;
+    const char* name() const override{return "stream";}
+};
+
+//Builds a prefetcher from its kind (nextline, stride, stream); nullptr for
+//unknown kinds
+unique_ptr<Prefetcher> makePrefetcher(const string& kind,int blockSize,int degree,int distance);
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef REPLACEMENT_POLICY_H
+#define REPLACEMENT_POLICY_H
+
+#include <vector>
+#include <unordered_map>
+#include <climits>
+using namespace std;
+
+//Replacement policies plugged into CacheT at compile time. Every policy
+//provides:
+//  init(sets,ways)        size its per-set/per-line state
+//  hit(set,way,now)       a lookup hit way
+//  fill(set,way,now)      a block was placed in way
+//  victim(set,now)        way to evict from a full set
+//  name()                 label used by Cache::stats
+//`now` is the cache's access counter (1-based). Policies only keep per-set
+//state and never draw from a shared RNG, so sets can be simulated
+//independently.
+
+//Stateless 64-bit mix used for the randomised policies
+inline unsigned long long policyHash(unsigned long long x){
+    x^=x>>33;
+    x*=0xff51afd7ed558ccdULL;
+    x^=x>>33;
+    x*=0xc4ceb9fe1a85ec53ULL;
+    x^=x>>33;
+    return x;
+}
+
+//Evicts the way filled longest ago
+struct FifoPolicy{
+    int ways=0;
+    vector<long long> stamp;
+
+    void init(int sets,int w){ways=w;stamp.assign((size_t)sets*w,0);}
+    void hit(int,int,long long){}
+    void fill(int set,int way,long long now){stamp[(size_t)set*ways+way]=now;}
+    int victim(int set,long long) const{
+        const long long* s=&stamp[(size_t)set*ways];
+        int vic=0;
+        for(int i=1;i<ways;i++) if(s[i]<s[vic]) vic=i;
+        return vic;
+    }
+    static const char* name(){return "FIFO";}
+};
+
+//Evicts the way used longest ago
+struct LruPolicy{
+    int ways=0;
+    vector<long long> stamp;
+
+    void init(int sets,int w){ways=w;stamp.assign((size_t)sets*w,0);}
+    void hit(int set,int way,long long now){stamp[(size_t)set*ways+way]=now;}
+    void fill(int set,int way,long long now){stamp[(size_t)set*ways+way]=now;}
+    int victim(int set,long long) const{
+        const long long* s=&stamp[(size_t)set*ways];
+        int vic=0;
+        for(int i=1;i<ways;i++) if(s[i]<s[vic]) vic=i;
+        return vic;
+    }
+    static const char* name(){return "LRU";}
+};
+
+//Tree pseudo-LRU: one bit per internal node of a binary tree over the ways,
+//pointing towards the half to evict from next. Non power-of-two
+//associativities use the next power of two and never descend into
+//missing ways.
+struct PlruPolicy{
+    int ways=0;
+    int leaves=1;
+    vector<unsigned long long> bits; //bit n is tree node n (root = 1)
+
+    void init(int sets,int w){
+        ways=w;
+        leaves=1;
+        while(leaves<w) leaves<<=1;
+        bits.assign(sets,0);
+    }
+    void touch(int set,int way){
+        unsigned long long b=bits[set];
+        int node=1,lo=0;
+        for(int span=leaves;span>1;span>>=1){
+            int half=span>>1;
+            if(way<lo+half){
+                b|=1ULL<<node; //point away, to the right half
+                node=2*node;
+            }else{
+                b&=~(1ULL<<node);
+                node=2*node+1;
+                lo+=half;
+            }
+        }
+        bits[set]=b;
+    }
+    void hit(int set,int way,long long){touch(set,way);}
+    void fill(int set,int way,long long){touch(set,way);}
+    int victim(int set,long long) const{
+        unsigned long long b=bits[set];
+        int node=1,lo=0;
+        for(int span=leaves;span>1;span>>=1){
+            int half=span>>1;
+            bool right=(b>>node)&1;
+            if(right && lo+half>=ways) right=false;
+            if(right){
+                node=2*node+1;
+                lo+=half;
+            }else{
+                node=2*node;
+            }
+        }
+        return lo;
+    }
+    static const char* name(){return "PLRU";}
+};
+
+//Re-reference interval prediction with 2-bit RRPVs. SRRIP inserts at
+//"long" (2); BRRIP inserts at "distant" (3) except for one fill in 32.
+template<bool Bimodal>
+struct RripPolicy{
+    static constexpr unsigned char MAXRRPV=3;
+    int ways=0;
+    vector<unsigned char> rrpv;
+
+    void init(int sets,int w){ways=w;rrpv.assign((size_t)sets*w,MAXRRPV);}
+    void hit(int set,int way,long long){rrpv[(size_t)set*ways+way]=0;}
+    void fill(int set,int way,long long now){
+        unsigned char v=MAXRRPV-1;
+        if(Bimodal && (policyHash(now)&31)!=0) v=MAXRRPV;
+        rrpv[(size_t)set*ways+way]=v;
+    }
+    int victim(int set,long long){
+        unsigned char* r=&rrpv[(size_t)set*ways];
+        unsigned char oldest=0;
+        for(int i=0;i<ways;i++) if(r[i]>oldest) oldest=r[i];
+        //Age the whole set in one step instead of looping until a way hits MAXRRPV
+        unsigned char age=MAXRRPV-oldest;
+        int vic=-1;
+        for(int i=0;i<ways;i++){
+            r[i]+=age;
+            if(vic<0 && r[i]==MAXRRPV) vic=i;
+        }
+        return vic;
+    }
+    static const char* name(){return Bimodal?"BRRIP":"SRRIP";}
+};
+typedef RripPolicy<false> SrripPolicy;
+typedef RripPolicy<true> BrripPolicy;
+
+//Uniformly random victim, derived from (set, time) so results are
+//reproducible and independent of simulation order
+struct RandomPolicy{
+    int ways=0;
+
+    void init(int,int w){ways=w;}
+    void hit(int,int,long long){}
+    void fill(int,int,long long){}
+    int victim(int set,long long now) const{
+        return policyHash((unsigned long long)now*0x9e3779b97f4a7c15ULL^set)%ways;
+    }
+    static const char* name(){return "Random";}
+};
+
+//Belady's OPT: evicts the line whose next use is furthest away. Needs the
+//whole trace up front: prepare() builds a next-use index where nextUse[i] is
+//the position of the next access to the same block as access i (LLONG_MAX if
+//none). The cache must then see exactly that trace, in order.
+struct OptPolicy{
+    int ways=0;
+    vector<long long> stamp;
+    vector<long long> nextUse;
+
+    void init(int sets,int w){ways=w;stamp.assign((size_t)sets*w,0);}
+    template<class Addr>
+    void prepare(const vector<Addr>& trace,int blockSize){
+        nextUse.assign(trace.size(),LLONG_MAX);
+        unordered_map<long long,long long> seen;
+        seen.reserve(trace.size());
+        for(long long i=(long long)trace.size()-1;i>=0;i--){
+            long long block=(long long)(trace[i]/blockSize);
+            auto it=seen.find(block);
+            if(it!=seen.end()){
+                nextUse[i]=it->second;
+                it->second=i+1;
+            }else{
+                seen.emplace(block,i+1);
+            }
+        }
+    }
+    long long next(long long now) const{
+        return now-1<(long long)nextUse.size()?nextUse[now-1]:LLONG_MAX;
+    }
+    void hit(int set,int way,long long now){stamp[(size_t)set*ways+way]=next(now);}
+    void fill(int set,int way,long long now){stamp[(size_t)set*ways+way]=next(now);}
+    int victim(int set,long long) const{
+        const long long* s=&stamp[(size_t)set*ways];
+        int vic=0;
+        for(int i=1;i<ways;i++) if(s[i]>s[vic]) vic=i;
+        return vic;
+    }
+    static const char* name(){return "OPT";}
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+#include <string>
+#include "PhysicalMemory.h"
+#include "MultilevelCache.h"
+#include "Buddy.h"
+#include "SlabAllocator.h"
+#include "VirtualMemory.h"
+#include "Tlb.h"
+#include "Batch.h"
+using namespace std;
+
+enum CommandResult
+{
+    CMD_OK,
+    CMD_USAGE, // missing or malformed arguments
+    CMD_EXIT
+};
+
+// Everything the interactive commands act on. The REPL, --batch and the
+// test runner all drive the simulator through execute(), which writes the
+// command's output to cout.
+struct Simulator
+{
+    PhysicalMemory pm;
+    MultilevelCache Mc;
+    Buddy ba;
+    SlabAllocator slab;
+    VirtualMemory vm;
+    Tlb tlb;
+    long long unknownCommands;
+
+    Simulator(const HierarchyConfig &cfg = defaultHierarchyConfig());
+    Simulator(const Simulator &) = delete;
+    Simulator &operator=(const Simulator &) = delete;
+
+    // Runs one command (word 0 is its name); unknown commands and missing
+    // arguments print a message
+    CommandResult execute(const CommandArgs &args);
+    // Splits line and runs it; blank lines do nothing
+    CommandResult execute(const string &line);
+};
+
+void printHelp();
+
+// Streams a trace through the hierarchy and prints only aggregate results
+bool replayTrace(MultilevelCache &Mc, const string &path);
+
+// Runs a command file without prompts: the file is memory-mapped, each line
+// split in place and dispatched through the command table, and all output
+// goes through one large buffer (or nowhere with quiet). Blank lines and
+// lines starting with '#' are skipped; exit stops the run early.
+bool runBatch(Simulator &s, const string &path, bool quiet);
+
+#endif
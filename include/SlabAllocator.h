@@ -0,0 +1,131 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "Buddy.h"
+using namespace std;
+
+// Slab allocator for small objects, layered on Buddy in the style of the
+// kernel's kmem caches. Each size class carves its own Buddy blocks (slabs)
+// into equal objects, so a request wastes only the gap to its class instead
+// of rounding up to a power of two. Requests above the largest class go to
+// Buddy directly.
+//
+// Each CPU keeps two magazines (stacks of free objects) per class, after
+// Bonwick and Adams' magazine layer: alloc and free touch only the CPU's own
+// magazines unless both are empty/full, and then exchange a whole magazine
+// with the shared depot under the lock. Below the depot, every slab has an
+// index freelist and sits on its class's empty, partial or full list, so
+// every step is O(1). A class keeps at most one empty slab; further empty
+// slabs go straight back to Buddy, and reclaim() returns the rest.
+//
+// Like ConcurrentBuddy, a CPU's magazines must only be used by the thread
+// driving that CPU. All metadata lives outside the arena. Object states are
+// atomic and indexed by offset, so free() claims an object with one
+// compare-and-swap before it looks at any slab: of two racing frees of the
+// same object only one succeeds.
+class SlabAllocator
+{
+    typedef unsigned long long u64;
+
+    enum ObjectState : unsigned char
+    {
+        OBJ_FREE,     // on its slab's freelist
+        OBJ_CACHED,   // in a magazine or the depot
+        OBJ_ALLOCATED
+    };
+    enum SlabList
+    {
+        SLAB_EMPTY,
+        SLAB_PARTIAL,
+        SLAB_FULL,
+        SLAB_LISTS
+    };
+
+    struct Slab
+    {
+        u64 base;
+        int cls;
+        int inuse;
+        int freeHead;
+        int list;
+        int prev, next; // on its class's list
+        vector<int> nextFree;
+        vector<unsigned> requested;
+    };
+
+    struct SizeClass
+    {
+        int objSize;
+        int objsPerSlab;
+        u64 slabBytes;
+        int head[SLAB_LISTS];
+        int count[SLAB_LISTS];
+        vector<vector<u64>> depot; // full magazines
+        long long grows;
+        long long shrinks;
+    };
+
+    struct alignas(64) CpuMagazines
+    {
+        vector<vector<u64>> loaded, previous; // per class
+        long long allocs = 0;
+        long long frees = 0;
+        long long depotTrips = 0;
+    };
+
+    Buddy area;
+    u64 arenaBytes;
+    mutex lock;
+    vector<SizeClass> classes;
+    vector<Slab> slabs; // one slot per 4 KiB of arena, enough for any mix of slabs
+    vector<int> freeSlots;
+    vector<int> pageOwner; // slab covering each 4 KiB page, -1 if none
+    // ObjectState of the object starting at each 8-byte granule; granules
+    // that start no object stay OBJ_FREE
+    vector<atomic<unsigned char>> objState;
+    vector<CpuMagazines> cpus;
+    int magazineSize;
+    // Requests above the largest class, served by Buddy: offset -> requested
+    unordered_map<u64, u64> large;
+    long long failures;
+
+    int classOf(u64 sz) const;
+    void link(int cls, int s, int list);
+    void unlink(int cls, int s);
+    int grow(int cls);
+    void releaseSlab(int s);
+    long long takeObject(int cls);
+    void putObject(int s, int idx);
+    void flushMagazine(vector<u64> &mag);
+    bool locate(u64 off, int &s, int &idx) const;
+    atomic<unsigned char> &stateOf(u64 off) { return objState[off / GRANULE]; }
+
+public:
+    static const int PAGE = 4096;
+    static const int GRANULE = 8; // smallest class
+
+    SlabAllocator(u64 arenaBytes, int cpus = 1, int magazineSize = 16);
+    SlabAllocator(const SlabAllocator &) = delete;
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    // Offset of a new object of sz bytes, or -1
+    long long alloc(int cpu, u64 sz);
+    // False for offsets that are not a live allocation (invalid or double free)
+    bool free(int cpu, u64 off);
+    // Returns cpu's magazines to the depot
+    void drain(int cpu);
+    // Flushes the depot into the slabs and gives every empty slab back to
+    // Buddy; returns the bytes released. CPUs should be drained first.
+    u64 reclaim();
+
+    int cpuCount() const { return cpus.size(); }
+    // Per-class slabs, objects and internal fragmentation, against what
+    // Buddy's power-of-two rounding would waste on the same requests.
+    // Exact only while no CPU is allocating.
+    void stats();
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef STACK_DISTANCE_H
+#define STACK_DISTANCE_H
+
+#include <vector>
+#include <unordered_map>
+#include "Trace.h"
+using namespace std;
+
+//One point of a miss-ratio curve; assoc 0 means fully associative
+struct SweepPoint{
+    int blockSize;
+    int sets;
+    int assoc;
+    long long size;
+    long long misses;
+    double missRatio;
+};
+
+//Single-pass LRU sweep (Mattson's stack algorithm). For an LRU cache with S
+//sets an access hits with A ways exactly when fewer than A distinct blocks
+//of its set were touched since its previous access: its stack distance
+//within the set. One pass that records the per-set stack distance histogram
+//for every block size and power-of-two set count therefore yields the
+//misses of every size/associativity combination at once.
+//
+//Distances come from a Fenwick tree per set over the set's own access clock,
+//holding a 1 at the last access of every block. The distance of a re-access
+//is the number of 1s after its previous slot. When a set's clock reaches the
+//tree's capacity the live slots are compacted to the front and the capacity
+//is doubled if more than half of it is live.
+class CacheSweep{
+    struct SetStack{
+        vector<int> tree;          //Fenwick tree over slots
+        vector<unsigned> owner;    //slot -> block id
+        int clock=0;
+        int live=0;
+    };
+    struct Geometry{
+        int sets;
+        int cap;                   //distances >= cap are only counted
+        vector<SetStack> stacks;
+        vector<long long> hist;    //hist[d], d capped at cap
+    };
+    struct Granule{
+        int blockSize;
+        unordered_map<unsigned long long,unsigned> ids;
+        vector<int> slots;         //slots[id*geoms.size()+g]
+        vector<Geometry> geoms;    //sets = 1, then minSets..maxSets
+        long long cold=0;
+    };
+    vector<Granule> granules;
+    long long minSize,maxSize;
+    int maxAssoc;
+    long long accesses=0;
+
+    static void compact(SetStack& st,vector<int>& slots,int stride,int g);
+    static int touch(SetStack& st,vector<int>& slots,int stride,int g,unsigned id,int oldSlot);
+
+    public:
+    //blockSizes and maxAssoc must be powers of two and 0<minSize<=maxSize;
+    //throws invalid_argument if maxSize holds 2^30 or more lines of a block size
+    CacheSweep(const vector<int>& blockSizes,long long minSize,long long maxSize,int maxAssoc);
+    void access(unsigned long long addr);
+    long long replay(TraceReader& trace);
+    long long getAccesses() const{return accesses;}
+    //Every power-of-two size in [minSize,maxSize] for every block size, with
+    //associativities 1..maxAssoc and fully associative
+    vector<SweepPoint> curve() const;
+    void printCurves() const;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef TLB_H
+#define TLB_H
+
+#include <vector>
+#include "Cache.h"
+using namespace std;
+
+//Page sizes, indexed 0..2 wherever a per-size array appears
+const int TLB_PAGE_SIZES=3;
+const int TLB_SHIFTS[TLB_PAGE_SIZES]={12,21,30};
+
+struct TlbConfig{
+    int l1Entries[TLB_PAGE_SIZES];   //L1 dTLB, one array per page size
+    int l1Assoc[TLB_PAGE_SIZES];
+    int l2Entries;                   //STLB, shared by 4 KiB and 2 MiB pages
+    int l2Assoc;
+    int l2GiantEntries;              //STLB for 1 GiB pages
+    int l2GiantAssoc;
+    int pwcEntries;                  //page-walk cache, per upper table level
+    int l2Latency;                   //cycles for an L1 miss that hits the STLB
+    int walkLatency;                 //cycles per page table read when no cache hierarchy is given
+};
+
+//Skylake-like geometry: 64/32/4-entry L1 dTLBs, 1536-entry 12-way STLB
+TlbConfig defaultTlbConfig();
+
+enum TlbOutcome{TLB_L1_HIT,TLB_L2_HIT,TLB_WALK};
+
+//Two-level data TLB with a page-walk cache. Every structure is a
+//CacheT<LruPolicy> with 1-byte blocks whose addresses are
+//asid<<40 | size<<38 | page number, so the usual set indexing spreads
+//consecutive pages over the sets.
+//
+//The page-walk cache keeps the upper entries of recent walks (PML4E, PDPTE
+//and PDE, one fully associative array each). A walk starts below the deepest
+//level it hits, so a 4 KiB walk reads one to four entries.
+class Tlb{
+    TlbConfig cfg;
+    vector<CacheT<LruPolicy>> l1;
+    CacheT<LruPolicy> l2;
+    CacheT<LruPolicy> l2Giant;
+    vector<CacheT<LruPolicy>> pwc;   //by table level, as pwcHits
+    long long accesses=0;
+    long long l1Hits[TLB_PAGE_SIZES]={0,0,0};
+    long long l1Misses[TLB_PAGE_SIZES]={0,0,0};
+    long long l2Hits=0;
+    long long l2Misses=0;
+    long long pwcHits[3]={0,0,0};   //by table level: PML4E, PDPTE, PDE
+    long long walkReads=0;
+    long long walkCycles=0;
+    long long shootdowns=0;
+
+    CacheT<LruPolicy>& stlb(int size){return size==2?l2Giant:l2;}
+
+    public:
+    Tlb(const TlbConfig& cfg);
+
+    //Looks up the page of vaddr (pageShift 12, 21 or 30), filling the TLBs
+    //on a miss. On TLB_WALK, firstLevel is the first page table level the
+    //walker reads (the ones above came from the page-walk cache), and the
+    //page-walk cache is filled.
+    TlbOutcome lookup(unsigned long long asid,unsigned long long vaddr,int pageShift,int& firstLevel);
+    //Charges the latency of a walk's page table reads
+    void addWalkCycles(long long cycles){walkCycles+=cycles;}
+    //Shootdown of the page mapping vaddr
+    void invalidate(unsigned long long asid,unsigned long long vaddr,int pageShift);
+    //Drops the page-walk cache entry at level that points to the table
+    //covering vaddr, once that table is freed
+    void invalidateWalk(unsigned long long asid,unsigned long long vaddr,int level);
+
+    int getWalkLatency() const{return cfg.walkLatency;}
+    void stats() const;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "MappedFile.h"
+using namespace std;
+
+struct TraceRecord{
+    unsigned long long addr;
+    bool write;
+    unsigned short core;   //issuing core for multi-core traces, else 0
+    unsigned long long pc; //issuing instruction if the trace records it, else 0
+};
+
+//On-disk trace formats:
+//  TRACE_TEXT   one access per line: "<addr>", "R <addr>", "W <addr>" or
+//               "CacheAccess <addr>", optionally prefixed by a core number as
+//               "<core> R|W <addr>", and optionally followed by the pc of
+//               the access; decimal or 0x-hex; '#' starts a comment.
+//               Only the text format carries pcs.
+//  TRACE_RAW    "MTRCRAW1" then one little-endian u64 per access: bit 63 is
+//               the write flag, bits 56-62 the core, bits 0-55 the address,
+//               so it holds cores up to 127 and 56-bit addresses
+//  TRACE_VARINT "MTRCVAR2" then one LEB128 varint per access holding
+//               zigzag(addr-prevAddr)<<2|coreChanged<<1|write, followed by
+//               the new core as a second varint when coreChanged is set.
+//               Address deltas must fit in 62 bits, sign included.
+//               "MTRCVAR1" files (zigzag<<1|write, core 0) are still read.
+//Every reader skips and counts (skippedLines()) the same malformed records:
+//numbers that overflow 64 bits, cores above 65535, truncated varints and a
+//partial RAW record at the end of the file.
+enum TraceFormat{TRACE_TEXT,TRACE_RAW,TRACE_VARINT};
+
+bool parseTraceFormat(const string& name,TraceFormat& fmt);
+
+//Streams records out of a memory-mapped trace file in batches; the format is
+//detected from the header.
+class TraceReader{
+    private:
+    MappedFile file;
+    const char* data;
+    size_t len;
+    size_t pos;
+    size_t bodyStart;
+    TraceFormat fmt;
+    unsigned long long prev;
+    unsigned long long prevCore;   //as decoded, may exceed a record's core
+    bool varintCores;   //MTRCVAR2 layout
+    long long badLines;
+
+    public:
+    TraceReader(const string& path);
+    TraceReader(const TraceReader&)=delete;
+    TraceReader& operator=(const TraceReader&)=delete;
+
+    bool good() const{return file.good();}
+    TraceFormat format() const{return fmt;}
+    long long skippedLines() const{return badLines;}
+
+    //Decodes up to max records into out and returns how many were written;
+    //0 means the trace is exhausted
+    size_t read(TraceRecord* out,size_t max);
+    void rewind();
+};
+
+class TraceWriter{
+    private:
+    FILE* file;
+    TraceFormat fmt;
+    unsigned long long prev;
+    unsigned short prevCore;
+    vector<char> buf;
+    bool failed;   //a write to the file fell short
+
+    void flush();
+
+    public:
+    TraceWriter(const string& path,TraceFormat fmt);
+    ~TraceWriter();
+    TraceWriter(const TraceWriter&)=delete;
+    TraceWriter& operator=(const TraceWriter&)=delete;
+
+    //False once the file could not be opened or written
+    bool good() const{return file!=nullptr && !failed;}
+    //False if rec does not fit the format (nothing is written then) or the
+    //file could not be written
+    bool write(const TraceRecord& rec);
+    //Flushes and closes; false if any write to the file failed
+    bool close();
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef VIRTUAL_MEMORY_H
+#define VIRTUAL_MEMORY_H
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "Buddy.h"
+#include "Trace.h"
+#include "Tlb.h"
+using namespace std;
+
+class MultilevelCache;
+
+//x86-64 style 48-bit virtual addresses: four 9-bit radix levels over 4 KiB
+//pages
+const int PAGE_SHIFT=12;
+const unsigned long long PAGE_SIZE=1ULL<<PAGE_SHIFT;
+const int PT_LEVELS=4;
+const int PT_BITS=9;
+const int PT_ENTRIES=1<<PT_BITS;
+const int VA_BITS=PAGE_SHIFT+PT_LEVELS*PT_BITS;
+//Huge pages map a whole region from a level 2 (2 MiB) or level 1 (1 GiB)
+//entry
+const int HUGE_SHIFT=PAGE_SHIFT+PT_BITS;
+const int GIANT_SHIFT=PAGE_SHIFT+2*PT_BITS;
+
+//Page table entry flags; the frame (or, above the leaves, the child node)
+//number sits above PAGE_SHIFT
+const unsigned long long PTE_PRESENT=1;
+const unsigned long long PTE_ACCESSED=2;
+const unsigned long long PTE_DIRTY=4;
+const unsigned long long PTE_SWAPPED=8;   //evicted; the next touch is a major fault
+const unsigned long long PTE_HUGE=16;     //leaf above the last level
+
+enum TranslateResult{XLATE_HIT,XLATE_MINOR_FAULT,XLATE_MAJOR_FAULT,XLATE_SEGFAULT};
+
+//Transparent huge pages for 2 MiB regions:
+//  never    4 KiB pages only
+//  always   a fault in an empty region maps a whole 2 MiB page
+//  promote  a region is collapsed into a 2 MiB page once a threshold of its
+//           4 KiB pages have been faulted in (khugepaged)
+//Either way the 2 MiB page needs a free order-21 Buddy block; without one
+//the region stays on 4 KiB pages.
+enum ThpMode{THP_NEVER,THP_ALWAYS,THP_PROMOTE};
+
+struct PageTableNode{
+    unsigned long long e[PT_ENTRIES];
+    int used;   //last level: entries ever faulted in
+    int collapseWait;   //last level: faults to go before collapse is retried
+};
+
+//Per-process address space
+struct AddressSpace{
+    int root;
+    unsigned long long asid;   //tags TLB entries; never reused
+    //Last-translation cache: the leaf PTE of the last page touched, which
+    //maps vaddr>>lastShift == lastPage
+    unsigned long long lastPage;
+    int lastShift;
+    unsigned long long* lastPte;
+    long long accesses;
+    long long minorFaults;
+    long long majorFaults;
+    long long segfaults;
+    long long residentPages;   //in 4 KiB frames, huge pages included
+    long long hugePages;
+    long long giantPages;
+    long long tableNodes;
+};
+
+//Demand-paged virtual memory for any number of processes. Each process has a
+//4-level radix page table; page frames come from a Buddy arena of
+//frameCount 4 KiB frames. A fault on a missing page takes a free frame, or,
+//once all frames are in use, evicts a page with the clock algorithm: a page
+//accessed since the hand last passed gets a second chance. Huge pages take
+//an aligned high-order Buddy block and are evicted whole.
+//
+//Page table nodes live in host memory and do not use up simulated frames.
+//For the cache simulation, the entry a walk reads at node n, index i sits at
+//physical address arena+n*4096+i*8, just past the frames.
+class VirtualMemory{
+    private:
+    struct Frame{
+        int pid;
+        unsigned long long vpn;
+        unsigned long long* pte;   //nullptr while free or inside a huge page
+        int shift;                 //page size of the mapping starting here
+    };
+    int frameCount;
+    int framesUsed;
+    Buddy frameArena;
+    unsigned long long tableBase;
+    vector<Frame> frames;
+    int hand;
+    vector<unique_ptr<PageTableNode>> nodes;
+    vector<int> freeNodes;
+    unordered_map<int,AddressSpace> spaces;
+    unsigned long long nextAsid;
+    int lastPid;
+    AddressSpace* lastSpace;
+    long long evictions;
+    long long dirtyEvictions;
+    ThpMode thp;
+    bool giant;
+    int promoteThreshold;
+    long long promotions;
+    long long hugeFallbacks;
+    Tlb* tlb;
+
+    int newNode();
+    int takeFrame();
+    int takeHuge(int shift);
+    void evictOne();
+    AddressSpace* space(int pid,bool create);
+    TranslateResult fault(AddressSpace& as,int pid,unsigned long long vaddr);
+    void map(AddressSpace& as,int pid,unsigned long long* pte,unsigned long long vaddr,int frame,int shift);
+    bool collapse(AddressSpace& as,int pid,unsigned long long* pde,int node,unsigned long long vaddr);
+    void freeTable(int node,int level);
+    TlbOutcome tlbAccess(AddressSpace& as,unsigned long long vaddr,int shift,MultilevelCache* cache);
+
+    public:
+    VirtualMemory(int frameCount);
+
+    bool createProcess(int pid);
+    //Releases pid's frames and page table; false if pid does not exist
+    bool destroyProcess(int pid);
+
+    //Huge page policy; giant enables 1 GiB pages for faults in empty 1 GiB
+    //regions. Takes effect for later faults.
+    void setHugePages(ThpMode mode,bool giant,int promoteThreshold=PT_ENTRIES);
+    //Models TLB lookups and page walks for access() and replay(); tlb is not
+    //owned
+    void attachTlb(Tlb* tlb);
+
+    //Translates vaddr for pid (created on first use), paging it in on demand;
+    //pageShift gets the size of the page that maps it
+    TranslateResult translate(int pid,unsigned long long vaddr,bool write,unsigned long long& paddr,int& pageShift);
+    TranslateResult translate(int pid,unsigned long long vaddr,bool write,unsigned long long& paddr);
+    //translate() and the TLB with a line of output, for the CLI
+    void access(int pid,unsigned long long vaddr,bool write);
+    //Translates every record of trace (core = pid) and, if cache is given,
+    //runs the physical address through it, after the page table entries of
+    //any TLB miss; returns the records replayed
+    long long replay(TraceReader& trace,MultilevelCache* cache);
+
+    int getFrameCount() const{return frameCount;}
+    void stats();
+};
+
+#endif
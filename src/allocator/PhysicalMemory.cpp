@@ -1,148 +1,330 @@
 #include "../../include/PhysicalMemory.h"
+#include "../../include/Instrumentation.h"
 #include <climits>
+#include <algorithm>
 #include <iostream>
 using namespace std;
 
+//A freed mark in blockAt, holding the next mark of its list or NIL
+static inline bool isMark(int tag){return tag<=-2;}
+static inline int markTag(int next){return -3-next;}
+static inline int markNext(int tag){return -3-tag;}
+
 PhysicalMemory::PhysicalMemory(int size){
     this->size=size;
     memory.resize(size);
-    head=new Block{0,size,true,nullptr,nullptr};
+    freeSlot=NIL;
+    blockAt.assign(size,NIL);
+    sizeIndexed=false;
+    flBitmap=0;
+    for(int fl=0;fl<TLSF_FL_COUNT;fl++){
+        slBitmap[fl]=0;
+        for(int sl=0;sl<TLSF_SL_COUNT;sl++) freeHead[fl][sl]=NIL;
+    }
+    head=newBlock(0,size,NIL,NIL);
+    insertFree(head);
     allocRequests=0;
     allocSuccess=0;
     allocFailure=0;
 }
 
+//Take a pool entry from the freelist, growing the pool only when it is empty
+int PhysicalMemory::newBlock(int start,int size,int next,int prev){
+    int idx=freeSlot;
+    if(idx!=NIL){
+        freeSlot=blocks[idx].next;
+        blocks[idx]=Block{start,size,true,next,prev};
+    }else{
+        idx=blocks.size();
+        blocks.push_back(Block{start,size,true,next,prev});
+        freeNext.push_back(NIL);
+        freePrev.push_back(NIL);
+        markHead.push_back(NIL);
+        markTail.push_back(NIL);
+        startFreed.push_back(0);
+        requested.push_back(0);
+    }
+    markHead[idx]=markTail[idx]=NIL;
+    startFreed[idx]=0;
+    blockAt[start]=idx;
+    return idx;
+}
+
+void PhysicalMemory::releaseBlock(int idx){
+    blockAt[blocks[idx].start]=NIL;
+    blocks[idx].next=freeSlot;
+    freeSlot=idx;
+}
+
+//Free block src has merged into dst, its predecessor: src's start becomes a
+//mark if it had been freed, followed by src's own marks
+void PhysicalMemory::absorb(int dst,int src){
+    int st=blocks[src].start;
+    bool freed=startFreed[src];
+    releaseBlock(src);
+    if(freed){
+        blockAt[st]=markTag(NIL);
+        if(markTail[dst]==NIL) markHead[dst]=st;
+        else blockAt[markTail[dst]]=markTag(st);
+        markTail[dst]=st;
+    }
+    if(markHead[src]==NIL) return;
+    if(markTail[dst]==NIL) markHead[dst]=markHead[src];
+    else blockAt[markTail[dst]]=markTag(markHead[src]);
+    markTail[dst]=markTail[src];
+}
+
+//TLSF class of a block size
+static void tlsfMapping(int size,int& fl,int& sl){
+    if(size<TLSF_SL_COUNT){
+        fl=0;
+        sl=size;
+    }else{
+        int log2=31-__builtin_clz(size);
+        fl=log2-TLSF_SL_LOG2+1;
+        sl=(size>>(log2-TLSF_SL_LOG2))-TLSF_SL_COUNT;
+    }
+}
+
+//Free blocks are indexed both by (size,start) and by TLSF class
+void PhysicalMemory::insertFree(int idx){
+    const Block& b=blocks[idx];
+    if(sizeIndexed) freeBySize.insert({b.size,b.start});
+    int fl,sl;
+    tlsfMapping(b.size,fl,sl);
+    freePrev[idx]=NIL;
+    freeNext[idx]=freeHead[fl][sl];
+    if(freeNext[idx]!=NIL) freePrev[freeNext[idx]]=idx;
+    freeHead[fl][sl]=idx;
+    flBitmap|=1u<<fl;
+    slBitmap[fl]|=1u<<sl;
+}
+
+void PhysicalMemory::removeFree(int idx){
+    const Block& b=blocks[idx];
+    if(sizeIndexed) freeBySize.erase({b.size,b.start});
+    int fl,sl;
+    tlsfMapping(b.size,fl,sl);
+    if(freePrev[idx]!=NIL) freeNext[freePrev[idx]]=freeNext[idx];
+    else freeHead[fl][sl]=freeNext[idx];
+    if(freeNext[idx]!=NIL) freePrev[freeNext[idx]]=freePrev[idx];
+    if(freeHead[fl][sl]==NIL){
+        slBitmap[fl]&=~(1u<<sl);
+        if(!slBitmap[fl]) flBitmap&=~(1u<<fl);
+    }
+}
+
 //Return the start of the allocated block
-int PhysicalMemory::allocate(Block* cur,int reqSize){
-    int st=cur->start;
-    if(cur->size>reqSize){
-        Block* newBlock=new Block{cur->start+reqSize,cur->size-reqSize,true,cur->next,cur};
-        if(cur->next) cur->next->prev=newBlock;
-        cur->next=newBlock;
-    }
-    cur->size=reqSize;
-    cur->free=false;
+int PhysicalMemory::allocate(int cur,int reqSize){
+    int st=blocks[cur].start;
+    bool split=blocks[cur].size-reqSize>=MIN_SPLIT;
+    int end=split?st+reqSize:st+blocks[cur].size;
+    removeFree(cur);
+    //Marks the block now covers are live addresses again, so freeing one is
+    //just an invalid free; the list is in address order, so they come first
+    int mark=markHead[cur];
+    while(mark!=NIL && mark<end){
+        int next=markNext(blockAt[mark]);
+        blockAt[mark]=NIL;
+        mark=next;
+    }
+    if(split){
+        bool restFreed=mark==end;
+        if(restFreed) mark=markNext(blockAt[end]);
+        Block& b=blocks[cur];
+        int nb=newBlock(end,b.size-reqSize,b.next,cur);
+        //newBlock may have grown the pool, so index again rather than use b
+        if(blocks[cur].next!=NIL) blocks[blocks[cur].next].prev=nb;
+        blocks[cur].next=nb;
+        //The remainder keeps the marks past the block; a mark at its start
+        //turns back into its start's freed flag
+        startFreed[nb]=restFreed;
+        markHead[nb]=mark;
+        markTail[nb]=mark==NIL?NIL:markTail[cur];
+        insertFree(nb);
+        blocks[cur].size=reqSize;
+    }
+    markHead[cur]=markTail[cur]=NIL;
+    startFreed[cur]=0;
+    requested[cur]=reqSize;
+    blocks[cur].free=false;
     allocSuccess++;
     return st;
 }
 //First-fit memory allocation
 int PhysicalMemory::allocateFirstFit(int reqSize){
+    MEMSIM_SCOPE("pm.alloc.first","alloc",PM_ALLOC_NS,"bytes",reqSize);
+    MEMSIM_COUNT(PM_ALLOC);
+    MEMSIM_HIST(PM_ALLOC_BYTES,reqSize);
     allocRequests++;
-    Block* cur=head;
-    while(cur){
-        if(cur->free && cur->size>=reqSize){
+    int cur=reqSize>0?head:NIL;
+    while(cur!=NIL){
+        if(blocks[cur].free && blocks[cur].size>=reqSize){
             return allocate(cur,reqSize); 
         }
-        cur=cur->next;
+        cur=blocks[cur].next;
     }
     allocFailure++;
+    MEMSIM_COUNT(PM_ALLOC_FAIL);
     return -1;
 }
+void PhysicalMemory::indexBySize(){
+    if(sizeIndexed) return;
+    for(int cur=head;cur!=NIL;cur=blocks[cur].next){
+        if(blocks[cur].free) freeBySize.insert({blocks[cur].size,blocks[cur].start});
+    }
+    sizeIndexed=true;
+}
+//Lowest-addressed free block of the smallest size that is >= reqSize
+int PhysicalMemory::smallestFit(int reqSize){
+    auto it=freeBySize.lower_bound({reqSize,INT_MIN});
+    return it==freeBySize.end()?NIL:blockAt[it->second];
+}
 //Best-fit memory allocation
 int PhysicalMemory::allocateBestFit(int reqSize){
+    MEMSIM_SCOPE("pm.alloc.best","alloc",PM_ALLOC_NS,"bytes",reqSize);
+    MEMSIM_COUNT(PM_ALLOC);
+    MEMSIM_HIST(PM_ALLOC_BYTES,reqSize);
     allocRequests++;
-    Block* best=nullptr;
-    int minSize=INT_MAX;
-    Block* cur=head;
-    while(cur){
-        if(cur->free && cur->size>=reqSize){
-            if(cur->size<minSize){
-                minSize=cur->size;
-                best=cur;
-            }
-        }
-        cur=cur->next;
-    }
-    if(best){
-        allocSuccess++;
+    indexBySize();
+    int best=reqSize>0?smallestFit(reqSize):NIL;
+    if(best!=NIL){
         return allocate(best,reqSize);
     }else{
         allocFailure++;
+        MEMSIM_COUNT(PM_ALLOC_FAIL);
         return -1;
     }
 }
 //Worst-fit memory allocation
 int PhysicalMemory::allocateWorstFit(int reqSize){
+    MEMSIM_SCOPE("pm.alloc.worst","alloc",PM_ALLOC_NS,"bytes",reqSize);
+    MEMSIM_COUNT(PM_ALLOC);
+    MEMSIM_HIST(PM_ALLOC_BYTES,reqSize);
     allocRequests++;
-    Block* worst=nullptr;
-    int maxSize=-1;
-    Block* cur=head;
-    while(cur){
-        if(cur->free && cur->size>=reqSize){
-            if(cur->size>maxSize){
-                maxSize=cur->size;
-                worst=cur;
-            }
-        }
-        cur=cur->next;
+    indexBySize();
+    int worst=NIL;
+    if(reqSize>0 && !freeBySize.empty()){
+        int maxSize=freeBySize.rbegin()->first;
+        //Among equally large blocks the scan used to pick the lowest address
+        if(maxSize>=reqSize) worst=smallestFit(maxSize);
     }
-    if(worst){
-        allocSuccess++;
+    if(worst!=NIL){
         return allocate(worst,reqSize);
     }else{
         allocFailure++;
+        MEMSIM_COUNT(PM_ALLOC_FAIL);
         return -1;
     }
 }
-void PhysicalMemory::freeMem(int st){
-    Block* cur=head;
-    while(cur){
-        if(cur->start==st && !cur->free){
-            cur->free=true;
-        //Merge with next block
-        if(cur->next && cur->next->free){
-            Block* temp=cur->next;
-            cur->size+=temp->size;
-            cur->next=temp->next;
-            if(temp->next){
-                temp->next->prev=cur;
+//Smallest non-empty class at or above the one reqSize rounds up to; every
+//block there fits. Failing that, the head of reqSize's own class may still fit.
+int PhysicalMemory::tlsfFind(int reqSize){
+    int fl,sl;
+    //Rounded in 64 bits: near INT_MAX the class above does not exist
+    long long rounded=reqSize;
+    if(reqSize>=TLSF_SL_COUNT){
+        int log2=31-__builtin_clz(reqSize);
+        rounded+=(1LL<<(log2-TLSF_SL_LOG2))-1;
+    }
+    if(rounded<=INT_MAX){
+        tlsfMapping((int)rounded,fl,sl);
+        if(fl<TLSF_FL_COUNT){
+            unsigned slMap=slBitmap[fl]&(~0u<<sl);
+            if(!slMap){
+                unsigned flMap=fl+1<TLSF_FL_COUNT?flBitmap&(~0u<<(fl+1)):0;
+                if(flMap){
+                    fl=__builtin_ctz(flMap);
+                    slMap=slBitmap[fl];
+                }
             }
-            delete temp;
+            if(slMap) return freeHead[fl][__builtin_ctz(slMap)];
         }
-        //Merge with previous block
-        if(cur->prev && cur->prev->free){
-            Block* temp=cur;
-            cur->prev->size+=cur->size;
-            cur->prev->next=cur->next;
-            if(cur->next){
-                cur->next->prev=cur->prev;
-            }
-            delete temp;
+    }
+    tlsfMapping(reqSize,fl,sl);
+    int cur=freeHead[fl][sl];
+    return cur!=NIL && blocks[cur].size>=reqSize?cur:NIL;
+}
+//TLSF memory allocation
+int PhysicalMemory::allocateTlsf(int reqSize){
+    MEMSIM_SCOPE("pm.alloc.tlsf","alloc",PM_ALLOC_NS,"bytes",reqSize);
+    MEMSIM_COUNT(PM_ALLOC);
+    MEMSIM_HIST(PM_ALLOC_BYTES,reqSize);
+    allocRequests++;
+    int cur=reqSize>0?tlsfFind(reqSize):NIL;
+    if(cur==NIL){
+        allocFailure++;
+        MEMSIM_COUNT(PM_ALLOC_FAIL);
+        return -1;
+    }
+    return allocate(cur,reqSize);
+}
+FreeResult PhysicalMemory::freeMem(int st){
+    MEMSIM_SCOPE("pm.free","free",PM_FREE_NS,"offset",st);
+    if(st<0 || st>=size) return FREE_INVALID;
+    int cur=blockAt[st];
+    //A freed block may since have merged into its neighbour and left a mark
+    if(isMark(cur)) return FREE_DOUBLE;
+    if(cur==NIL) return FREE_INVALID;
+    if(blocks[cur].free) return startFreed[cur]?FREE_DOUBLE:FREE_INVALID;
+    blocks[cur].free=true;
+    startFreed[cur]=1;
+    MEMSIM_COUNT(PM_FREE);
+    //Merge with next block
+    int nx=blocks[cur].next;
+    if(nx!=NIL && blocks[nx].free){
+        removeFree(nx);
+        blocks[cur].size+=blocks[nx].size;
+        blocks[cur].next=blocks[nx].next;
+        if(blocks[nx].next!=NIL){
+            blocks[blocks[nx].next].prev=cur;
         }
-        return;
+        absorb(cur,nx);
+    }
+    //Merge with previous block
+    int pv=blocks[cur].prev;
+    if(pv!=NIL && blocks[pv].free){
+        removeFree(pv);
+        blocks[pv].size+=blocks[cur].size;
+        blocks[pv].next=blocks[cur].next;
+        if(blocks[cur].next!=NIL){
+            blocks[blocks[cur].next].prev=pv;
         }
-        cur=cur->next;
+        absorb(pv,cur);
+        cur=pv;
     }
+    insertFree(cur);
+    return FREE_OK;
 }
 void PhysicalMemory::dump(){
     cout<<"\n Physical Memory Layout: \n";
-    Block* cur=head;
-    while(cur){
-        cout<<"["<<cur->start<<"-"<<cur->start+cur->size-1<<"]"<<(cur->free?"FREE":"USED")<<"("<<cur->size<<"bytes)\n";
-        cur=cur->next;
+    for(int cur=head;cur!=NIL;cur=blocks[cur].next){
+        const Block& b=blocks[cur];
+        cout<<"["<<b.start<<"-"<<b.start+b.size-1<<"]"<<(b.free?"FREE":"USED")<<"("<<b.size<<"bytes)\n";
     }
 }
 void PhysicalMemory::stats(){
     int totfree=0;
     int larfree=0;
     int allocated=0;
-    Block* cur=head;
+    int internal=0; //granted beyond what was asked for
     double success=(allocRequests>0)?((double)allocSuccess/allocRequests):0;
     double fail=1-success;
-    while(cur){
-        if(cur->free){
-            totfree+=cur->size;
-            larfree=max(larfree,cur->size);
+    for(int cur=head;cur!=NIL;cur=blocks[cur].next){
+        const Block& b=blocks[cur];
+        if(b.free){
+            totfree+=b.size;
+            larfree=max(larfree,b.size);
         }else{
-            allocated+=cur->size;
+            allocated+=b.size;
+            internal+=b.size-requested[cur];
         }
-        cur=cur->next;
     }
     cout<<"\nStats:\n";
     cout<<"Free Memory: "<<totfree<<"bytes\n";
     cout<<"Allocated memory: "<<allocated<<"bytes\n";
     cout<<"Largest Free Block: "<<larfree<<"bytes\n";
-    cout<<"Internal Fragmentation:"<<0<<'\n';
+    cout<<"Internal Fragmentation: "<<internal<<"bytes\n";
 
     if(totfree>0){
         double extfrag=1.0-(double)larfree/totfree;
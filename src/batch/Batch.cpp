@@ -0,0 +1,81 @@
+#include "../../include/Batch.h"
+#include <cstring>
+#include <unistd.h>
+using namespace std;
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+void splitCommand(const char *p, const char *end, CommandArgs &args)
+{
+    args.count = 0;
+    while (args.count < CommandArgs::MAX_WORDS)
+    {
+        while (p < end && isSpace(*p))
+            p++;
+        if (p == end)
+            break;
+        const char *start = p;
+        while (p < end && !isSpace(*p))
+            p++;
+        args.word[args.count++] = string_view(start, p - start);
+    }
+}
+
+OutputBuffer::OutputBuffer(int fd, size_t size) : buf(size), fd(fd)
+{
+    setp(buf.data(), buf.data() + buf.size());
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    drain();
+}
+
+bool OutputBuffer::drain()
+{
+    const char *p = pbase();
+    while (p < pptr())
+    {
+        ssize_t n = ::write(fd, p, pptr() - p);
+        if (n <= 0)
+            return false;
+        p += n;
+    }
+    setp(buf.data(), buf.data() + buf.size());
+    return true;
+}
+
+OutputBuffer::int_type OutputBuffer::overflow(int_type c)
+{
+    if (!drain())
+        return traits_type::eof();
+    if (c != traits_type::eof())
+    {
+        *pptr() = (char)c;
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+streamsize OutputBuffer::xsputn(const char *s, streamsize n)
+{
+    streamsize done = 0;
+    while (done < n)
+    {
+        if (pptr() == epptr() && !drain())
+            break;
+        streamsize room = min<streamsize>(epptr() - pptr(), n - done);
+        memcpy(pptr(), s + done, room);
+        pbump((int)room);
+        done += room;
+    }
+    return done;
+}
+
+int OutputBuffer::sync()
+{
+    return drain() ? 0 : -1;
+}
@@ -1,125 +1,205 @@
 #include "../../include/Buddy.h"
-#include <cmath>
+#include "../../include/Instrumentation.h"
 #include <iostream>
 #include <cstdlib>
-#include <cstring>
+#include <stdexcept>
 using namespace std;
 
-Buddy::Buddy(int sz)
+Buddy::Buddy(u64 sz, int minOrd)
 {
+    // Also keeps sz == 0 away from __builtin_clzll
+    if (minOrd < 0 || minOrd > 63 || sz < (1ULL << minOrd))
+        throw invalid_argument("Buddy arena is smaller than one minimum block");
     size = sz;
-    mxord = log2(sz);
-    blocks = new Block *[mxord + 1];
-    memset(blocks, 0, sizeof(Block *) * (mxord + 1));
-    Block *init = (Block *)malloc(sz);
-    init->ord = mxord;
-    init->prev = init->next = nullptr;
-    blocks[mxord] = init;
+    mxord = 63 - __builtin_clzll(sz);
+    mnord = minOrd;
+    if (mxord - mnord >= 32)
+        throw invalid_argument("Buddy arena holds 2^32 or more minimum blocks");
+    nonEmpty = 0;
+    for (unsigned &h : freeHead)
+        h = NIL_BLOCK;
+    // Links are only read for blocks on a free list, so they start
+    // uninitialised; like pairMap, untouched pages cost nothing
+    u64 count = 1ULL << (mxord - mnord);
+    nextFree = (unsigned *)malloc((count + 1) / 2 * sizeof(unsigned));
+    prevFree = (unsigned *)malloc((count + 1) / 2 * sizeof(unsigned));
+    liveOrder = (unsigned char *)calloc(count, 1);
+    // Pair bits for order k start at pairBase[k]; the top order has no buddy
+    pairBase.assign(mxord + 1, 0);
+    u64 bits = 0;
+    for (int k = mnord; k < mxord; k++)
+    {
+        pairBase[k] = bits;
+        bits += 1ULL << (mxord - k - 1);
+    }
+    // calloc hands back lazily zeroed pages, so multi-GiB arenas only pay for
+    // the part of the map they actually use
+    pairMap = (u64 *)calloc(bits / 64 + 1, sizeof(u64));
+    add(mxord, 0);
 }
 
-int Buddy::getOrd(int sz)
+Buddy::~Buddy()
 {
-    int ord = 0;
-    int cur = 1;
-    while (cur < sz)
-    {
-        cur = cur << 1;
-        ord++;
-    }
-    return ord;
+    ::free(pairMap);
+    ::free(nextFree);
+    ::free(prevFree);
+    ::free(liveOrder);
 }
 
-void Buddy::add(Block *bl)
+// Order of the smallest block holding sz bytes. Sizes above 2^63 give 64,
+// which no arena has, so callers reject them like any oversized request.
+int Buddy::getOrd(u64 sz)
 {
-    int o = bl->ord;
-    bl->prev = nullptr;
-    bl->next = blocks[o];
-    if (blocks[o])
-    {
-        blocks[o]->prev = bl;
-    }
-    blocks[o] = bl;
+    int ord = sz <= 1 ? 0 : 64 - __builtin_clzll(sz - 1);
+    return max(ord, mnord);
 }
 
-void Buddy::rem(Block *bl)
+void Buddy::togglePair(int ord, u64 off)
 {
-    int o = bl->ord;
-    if (bl->prev)
-    {
-        bl->prev->next = bl->next;
-    }
-    else
-    {
-        blocks[o] = bl->next;
-    }
-    if (bl->next)
-    {
-        bl->next->prev = bl->prev;
-    }
-    bl->prev = bl->next = nullptr;
+    if (ord >= mxord)
+        return;
+    u64 bit = pairBase[ord] + (off >> (ord + 1));
+    pairMap[bit >> 6] ^= 1ULL << (bit & 63);
 }
 
-void Buddy::split(int ord)
+bool Buddy::pairBit(int ord, u64 off) const
 {
-    Block *bl = blocks[ord];
-    rem(bl);
-    int nord = ord - 1;
-    int blsz = 1 << nord;
-    Block *bud = (Block *)((char *)bl + blsz);
-    bl->ord = nord;
-    bud->ord = nord;
-    add(bl);
-    add(bud);
+    if (ord >= mxord)
+        return false;
+    u64 bit = pairBase[ord] + (off >> (ord + 1));
+    return (pairMap[bit >> 6] >> (bit & 63)) & 1;
 }
 
-Buddy::Block *Buddy::getBud(Block *bl)
+// Two free blocks never start in the same pair of minimum blocks (they
+// would be free buddies, which merge), so links are stored per pair
+void Buddy::add(int ord, u64 off)
 {
-    int blsz = 1 << bl->ord;
-    uintptr_t offset = (uintptr_t)bl;
-    uintptr_t bud = offset ^ blsz;
-    return (Block *)bud;
+    unsigned i = off >> mnord;
+    nextFree[i >> 1] = freeHead[ord];
+    prevFree[i >> 1] = NIL_BLOCK;
+    if (freeHead[ord] != NIL_BLOCK)
+        prevFree[freeHead[ord] >> 1] = i;
+    freeHead[ord] = i;
+    nonEmpty |= 1ULL << ord;
+    togglePair(ord, off);
 }
 
-void Buddy::merge(Block *bl)
+void Buddy::rem(int ord, u64 off)
 {
-    while (bl->ord < mxord)
+    unsigned i = off >> mnord;
+    unsigned p = prevFree[i >> 1], n = nextFree[i >> 1];
+    if (p != NIL_BLOCK)
+        nextFree[p >> 1] = n;
+    else
+        freeHead[ord] = n;
+    if (n != NIL_BLOCK)
+        prevFree[n >> 1] = p;
+    if (freeHead[ord] == NIL_BLOCK)
     {
-        Block *bud = getBud(bl);
-        if (bud->ord != bl->ord)
-            break;
-        rem(bud);
-        if (bud < bl)
-            bl = bud;
-        bl->ord++;
+        nonEmpty &= ~(1ULL << ord);
     }
-    add(bl);
+    togglePair(ord, off);
 }
 
-Buddy::Block *Buddy::access(int sz)
+Buddy::u64 Buddy::pop(int ord)
 {
+    u64 off = (u64)freeHead[ord] << mnord;
+    rem(ord, off);
+    return off;
+}
+
+long long Buddy::access(u64 sz)
+{
+    MEMSIM_SCOPE("buddy.alloc", "alloc", BUDDY_ALLOC_NS, "bytes", sz);
+    MEMSIM_COUNT(BUDDY_ALLOC);
+    MEMSIM_HIST(BUDDY_ALLOC_BYTES, sz);
+    if (sz == 0)
+        return -1;
     int ord = getOrd(sz);
-    int i = ord;
-    while (i <= mxord && blocks[i] == nullptr)
-    {
-        i++;
-    }
-    if (i > mxord)
+    // Smallest non-empty order >= ord in a single bit scan
+    u64 avail = ord > mxord ? 0 : nonEmpty >> ord << ord;
+    if (!avail)
     {
+        MEMSIM_COUNT(BUDDY_ALLOC_FAIL);
         cout << "Out of memory\n";
-        return nullptr;
+        return -1;
     }
+    int i = __builtin_ctzll(avail);
+    u64 off = pop(i);
+    // Keep the low half, hand the high half of every split to the free lists
     while (i > ord)
     {
-        split(i);
         i--;
+        add(i, off + (1ULL << i));
+    }
+    liveOrder[off >> mnord] = ord + 1;
+    return off;
+}
+
+// Hands out up to count blocks of the given order. Blocks already on the
+// order's free list are used first; after that a larger block is carved into
+// many order-sized pieces at once instead of being split once per request.
+vector<Buddy::u64> Buddy::allocateN(int ord, int count)
+{
+    vector<u64> res;
+    if (ord < mnord || ord > mxord)
+        return res;
+    res.reserve(count);
+    while ((int)res.size() < count)
+    {
+        if (freeHead[ord] != NIL_BLOCK)
+        {
+            u64 off = pop(ord);
+            liveOrder[off >> mnord] = ord + 1;
+            res.push_back(off);
+            continue;
+        }
+        u64 avail = nonEmpty >> ord << ord;
+        if (!avail)
+            break;
+        int i = __builtin_ctzll(avail);
+        u64 big = pop(i);
+        u64 pieces = 1ULL << (i - ord);
+        u64 take = min(pieces, (u64)(count - res.size()));
+        for (u64 k = 0; k < take; k++)
+        {
+            u64 off = big + (k << ord);
+            liveOrder[off >> mnord] = ord + 1;
+            res.push_back(off);
+        }
+        // Return the untouched tail as the aligned blocks a chain of splits
+        // would have left behind
+        u64 off = take << ord;
+        u64 end = 1ULL << i;
+        while (off < end)
+        {
+            int k = __builtin_ctzll(off);
+            add(k, big + off);
+            off += 1ULL << k;
+        }
     }
-    Block *res = blocks[ord];
-    rem(res);
     return res;
 }
 
-void Buddy::free(void *bl)
+// Rejects offsets that are not the start of a live allocation (invalid or
+// double frees) with one byte lookup
+bool Buddy::free(u64 off)
 {
-    Block *blo = (Block *)bl;
-    merge(blo);
-}
\ No newline at end of file
+    MEMSIM_SCOPE("buddy.free", "free", BUDDY_FREE_NS, "offset", off);
+    if (off >> mxord || off & ((1ULL << mnord) - 1) || !liveOrder[off >> mnord])
+        return false;
+    MEMSIM_COUNT(BUDDY_FREE);
+    int ord = liveOrder[off >> mnord] - 1;
+    liveOrder[off >> mnord] = 0;
+    // off itself is not free, so a set pair bit means its buddy is free at
+    // this order: absorb it and carry on one order up
+    while (pairBit(ord, off))
+    {
+        u64 bud = off ^ (1ULL << ord);
+        rem(ord, bud);
+        off = min(off, bud);
+        ord++;
+    }
+    add(ord, off);
+    return true;
+}
@@ -0,0 +1,99 @@
+#include "../../include/ConcurrentBuddy.h"
+using namespace std;
+
+ConcurrentBuddy::ConcurrentBuddy(u64 sz, int cpus, int minOrd, int cachedOrders, int batch)
+    : area(sz, minOrd), caches(cpus), handedOut(1ULL << (area.maxOrder() - area.minOrder()))
+{
+    this->cachedOrders = cachedOrders;
+    this->batch = batch;
+    refills = 0;
+    drains = 0;
+    invalidFrees = 0;
+    for (auto &c : caches)
+    {
+        c.lists.resize(cachedOrders);
+    }
+}
+
+long long ConcurrentBuddy::access(int cpu, u64 sz)
+{
+    if (sz == 0)
+        return -1;
+    int idx = area.getOrd(sz) - area.minOrder();
+    if (idx >= cachedOrders)
+    {
+        long long off;
+        {
+            lock_guard<mutex> g(lock);
+            off = area.access(sz);
+        }
+        if (off >= 0)
+            handedOut[off >> area.minOrder()].store(idx + 1, memory_order_relaxed);
+        return off;
+    }
+    vector<u64> &list = caches[cpu].lists[idx];
+    if (list.empty())
+    {
+        // One lock round trip hands the CPU a whole batch
+        vector<u64> got;
+        {
+            lock_guard<mutex> g(lock);
+            got = area.allocateN(idx + area.minOrder(), batch);
+        }
+        if (got.empty())
+            return -1;
+        refills++;
+        // Hand out lowest offsets first
+        list.assign(got.rbegin(), got.rend());
+    }
+    u64 off = list.back();
+    list.pop_back();
+    handedOut[off >> area.minOrder()].store(idx + 1, memory_order_relaxed);
+    return off;
+}
+
+// Returns everything above keep entries to the shared area under one lock
+void ConcurrentBuddy::drainList(vector<u64> &list, size_t keep)
+{
+    if (list.size() <= keep)
+        return;
+    lock_guard<mutex> g(lock);
+    for (size_t i = keep; i < list.size(); i++)
+    {
+        if (!area.free(list[i]))
+            invalidFrees++;
+    }
+    list.resize(keep);
+    drains++;
+}
+
+bool ConcurrentBuddy::free(int cpu, u64 off, u64 sz)
+{
+    int idx = area.getOrd(sz) - area.minOrder();
+    unsigned char mark = idx + 1;
+    if (sz == 0 || area.getOrd(sz) > area.maxOrder() || off >> area.maxOrder() || off & ((1ULL << area.minOrder()) - 1) ||
+        !handedOut[off >> area.minOrder()].compare_exchange_strong(mark, 0, memory_order_relaxed))
+    {
+        invalidFrees++;
+        return false;
+    }
+    if (idx >= cachedOrders)
+    {
+        lock_guard<mutex> g(lock);
+        return area.free(off);
+    }
+    vector<u64> &list = caches[cpu].lists[idx];
+    list.push_back(off);
+    // Keep one batch around for the next refill, give back the rest
+    if ((int)list.size() >= 2 * batch)
+        drainList(list, batch);
+    return true;
+}
+
+void ConcurrentBuddy::drain(int cpu)
+{
+    for (auto &list : caches[cpu].lists)
+    {
+        drainList(list, 0);
+    }
+}
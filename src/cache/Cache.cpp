@@ -1,8 +1,14 @@
 #include "../../include/Cache.h"
 #include <iostream>
-#include <climits>
+#include <stdexcept>
+#include <thread>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-Cache::Cache(int size,int blockSize,int assoc){
+template<class Policy>
+CacheT<Policy>::CacheT(int size,int blockSize,int assoc){
+    if(assoc<1 || assoc>64) throw invalid_argument("Cache associativity must be between 1 and 64");
     this->size=size;
     this->blockSize=blockSize;
     this->associativity=assoc;
@@ -10,49 +16,297 @@ Cache::Cache(int size,int blockSize,int assoc){
     misses=0;
     time=0;
     setnum=size/(blockSize*assoc);
-    sets.resize(setnum,vector<CacheLine>(assoc));
+    tags.assign((size_t)setnum*assoc,0);
+    validMask.assign(setnum,0);
+    dirtyMask.assign(setnum,0);
+    repl.init(setnum,assoc);
+#ifdef MEMSIM_INSTRUMENT
+    heat.resize(setnum);
+#endif
 }
 
-bool Cache::access(int addr){
+//Bit w set when t[w]==tag, comparing as many ways per instruction as the
+//target allows
+static inline unsigned long long matchWays(const unsigned long long* t,int n,unsigned long long tag){
+    unsigned long long mask=0;
+    int w=0;
+#if defined(__AVX2__)
+    __m256i key=_mm256_set1_epi64x((long long)tag);
+    for(;w+4<=n;w+=4){
+        __m256i v=_mm256_loadu_si256((const __m256i*)(t+w));
+        unsigned long long m=_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v,key)));
+        mask|=m<<w;
+    }
+#elif defined(__SSE2__)
+    __m128i key=_mm_set1_epi64x((long long)tag);
+    for(;w+2<=n;w+=2){
+        __m128i v=_mm_loadu_si128((const __m128i*)(t+w));
+        //SSE2 has no 64-bit compare: both 32-bit halves must match
+        __m128i eq=_mm_cmpeq_epi32(v,key);
+        eq=_mm_and_si128(eq,_mm_shuffle_epi32(eq,_MM_SHUFFLE(2,3,0,1)));
+        unsigned long long m=_mm_movemask_pd(_mm_castsi128_pd(eq));
+        mask|=m<<w;
+    }
+#endif
+    for(;w<n;w++){
+        mask|=(unsigned long long)(t[w]==tag)<<w;
+    }
+    return mask;
+}
+
+template<class Policy>
+inline void CacheT<Policy>::locate(unsigned long long addr,int& setIdx,unsigned long long& tag) const{
+    unsigned long long blockAddr=addr/blockSize;
+    setIdx=blockAddr%setnum;
+    tag=blockAddr/setnum;
+}
+
+template<class Policy>
+inline unsigned long long CacheT<Policy>::hitMask(int setIdx,unsigned long long tag) const{
+    return matchWays(&tags[(size_t)setIdx*associativity],associativity,tag)&validMask[setIdx];
+}
+
+//Puts tag in the first invalid way, or in the policy's victim when the set is
+//full. Returns true if a valid line was replaced, leaving its tag and dirty
+//bit in oldTag/oldDirty.
+template<class Policy>
+inline bool CacheT<Policy>::place(int setIdx,unsigned long long tag,bool dirty,unsigned long long& oldTag,bool& oldDirty,long long now){
+    unsigned long long valid=validMask[setIdx];
+    unsigned long long all=associativity==64?~0ULL:((1ULL<<associativity)-1);
+    size_t base=(size_t)setIdx*associativity;
+    int vic;
+    bool evicted=valid==all;
+    if(!evicted){
+        vic=__builtin_ctzll(~valid);
+    }else{
+        vic=repl.victim(setIdx,now);
+        oldTag=tags[base+vic];
+        oldDirty=(dirtyMask[setIdx]>>vic)&1;
+    }
+    tags[base+vic]=tag;
+    validMask[setIdx]|=1ULL<<vic;
+    if(dirty) dirtyMask[setIdx]|=1ULL<<vic;
+    else dirtyMask[setIdx]&=~(1ULL<<vic);
+    repl.fill(setIdx,vic,now);
+    return evicted;
+}
+
+//Hit-or-fill at access time now; touches only setIdx's state
+template<class Policy>
+inline bool CacheT<Policy>::touch(int setIdx,unsigned long long tag,long long now){
+    unsigned long long hit=hitMask(setIdx,tag);
+    if(hit){
+        repl.hit(setIdx,__builtin_ctzll(hit),now);
+        return true;
+    }
+    unsigned long long oldTag;
+    bool oldDirty;
+    place(setIdx,tag,false,oldTag,oldDirty,now);
+    return false;
+}
+
+template<class Policy>
+bool CacheT<Policy>::access(unsigned long long addr){
     time++;
-    int blockAddr=addr/blockSize;
-    int setIdx=blockAddr%setnum;
-    int tag=blockAddr/setnum;
-    for(auto &line:sets[setIdx]){
-        if(line.valid && line.tag==tag){
-            hits++;
-            return true;
-        }
+    int setIdx;
+    unsigned long long tag;
+    locate(addr,setIdx,tag);
+    if(touch(setIdx,tag,time)){
+        hits++;
+        return true;
     }
     misses++;
-    for(auto &line:sets[setIdx]){
-        if(!line.valid){
-            line.valid=true;
-            line.tag=tag;
-            line.fifoTime=time;
-            return false;
+    MEMSIM_SET_MISS(heat,setIdx);
+    return false;
+}
+
+//One chunk of a sharded replay: bucket the accesses by owning worker with a
+//parallel counting scatter (order within a bucket is trace order), then let
+//every worker run its bucket
+template<class Policy>
+void CacheT<Policy>::replayShards(const unsigned long long* trace,size_t n,int threads){
+    vector<unsigned short> shard(n);
+    vector<size_t> count((size_t)threads*threads,0);   //[slice][shard]
+    vector<unsigned> order(n);
+    vector<long long> h(threads,0),m(threads,0);
+    auto slice=[n,threads](int t,size_t& lo,size_t& hi){
+        lo=n*t/threads;
+        hi=n*(t+1)/threads;
+    };
+    auto parallel=[threads](auto fn){
+        vector<thread> workers;
+        for(int t=1;t<threads;t++) workers.emplace_back(fn,t);
+        fn(0);
+        for(thread& w:workers) w.join();
+    };
+    parallel([&](int t){
+        size_t lo,hi;
+        slice(t,lo,hi);
+        size_t* c=&count[(size_t)t*threads];
+        for(size_t i=lo;i<hi;i++){
+            int setIdx=(trace[i]/blockSize)%setnum;
+            int s=(long long)setIdx*threads/setnum;
+            shard[i]=s;
+            c[s]++;
+        }
+    });
+    vector<size_t> start(threads+1,0);
+    size_t pos=0;
+    for(int s=0;s<threads;s++){
+        start[s]=pos;
+        for(int t=0;t<threads;t++){
+            size_t c=count[(size_t)t*threads+s];
+            count[(size_t)t*threads+s]=pos;
+            pos+=c;
         }
     }
-    int vic=0;
-    long long oldest=LLONG_MAX;
-    for(int i=0;i<associativity;i++){
-        if(sets[setIdx][i].fifoTime<oldest){
-            oldest=sets[setIdx][i].fifoTime;
-            vic=i;
+    start[threads]=pos;
+    parallel([&](int t){
+        size_t lo,hi;
+        slice(t,lo,hi);
+        size_t* c=&count[(size_t)t*threads];
+        for(size_t i=lo;i<hi;i++) order[c[shard[i]]++]=i;
+    });
+    long long base=time;
+    parallel([&](int s){
+        long long hit=0;
+        for(size_t j=start[s];j<start[s+1];j++){
+            size_t i=order[j];
+            int setIdx;
+            unsigned long long tag;
+            locate(trace[i],setIdx,tag);
+            bool h=touch(setIdx,tag,base+i+1);
+            hit+=h;
+            if(!h) MEMSIM_SET_MISS(heat,setIdx);
         }
+        h[s]=hit;
+        m[s]=(long long)(start[s+1]-start[s])-hit;
+    });
+    for(int s=0;s<threads;s++){
+        hits+=h[s];
+        misses+=m[s];
     }
-    sets[setIdx][vic].tag=tag;
-    sets[setIdx][vic].fifoTime=time;
-    sets[setIdx][vic].valid=true;
+    time+=n;
+}
 
+template<class Policy>
+void CacheT<Policy>::replay(const vector<unsigned long long>& trace,int threads){
+    //Chunks keep the per-access bookkeeping at 6 bytes and in cache-sized batches
+    static const size_t CHUNK=1<<22;
+    threads=min(threads,min(setnum,1024));
+    if(threads<=1){
+        for(unsigned long long addr:trace) access(addr);
+        return;
+    }
+    for(size_t off=0;off<trace.size();off+=CHUNK){
+        replayShards(trace.data()+off,min(CHUNK,trace.size()-off),threads);
+    }
+}
+
+template<class Policy>
+bool CacheT<Policy>::lookup(unsigned long long addr){
+    time++;
+    int setIdx;
+    unsigned long long tag;
+    locate(addr,setIdx,tag);
+    unsigned long long hit=hitMask(setIdx,tag);
+    if(hit){
+        hits++;
+        repl.hit(setIdx,__builtin_ctzll(hit),time);
+        return true;
+    }
+    misses++;
+    MEMSIM_SET_MISS(heat,setIdx);
     return false;
 }
 
-void Cache::stats(const string& name) const{
-    int total=hits+misses;
+template<class Policy>
+bool CacheT<Policy>::fill(unsigned long long addr,bool dirty,unsigned long long& victim,bool& victimDirty){
+    int setIdx;
+    unsigned long long tag;
+    locate(addr,setIdx,tag);
+    unsigned long long oldTag;
+    if(!place(setIdx,tag,dirty,oldTag,victimDirty,time)) return false;
+    victim=(oldTag*setnum+setIdx)*blockSize;
+    return true;
+}
+
+template<class Policy>
+bool CacheT<Policy>::contains(unsigned long long addr) const{
+    int setIdx;
+    unsigned long long tag;
+    locate(addr,setIdx,tag);
+    return hitMask(setIdx,tag)!=0;
+}
+
+template<class Policy>
+bool CacheT<Policy>::setDirty(unsigned long long addr){
+    int setIdx;
+    unsigned long long tag;
+    locate(addr,setIdx,tag);
+    unsigned long long hit=hitMask(setIdx,tag);
+    dirtyMask[setIdx]|=hit;
+    return hit!=0;
+}
+
+template<class Policy>
+bool CacheT<Policy>::invalidate(unsigned long long addr,bool& wasDirty){
+    int setIdx;
+    unsigned long long tag;
+    locate(addr,setIdx,tag);
+    unsigned long long hit=hitMask(setIdx,tag);
+    wasDirty=(dirtyMask[setIdx]&hit)!=0;
+    if(!hit) return false;
+    validMask[setIdx]&=~hit;
+    dirtyMask[setIdx]&=~hit;
+    return true;
+}
+
+template<class Policy>
+void CacheT<Policy>::stats(const string& name) const{
+    long long total=hits+misses;
     double hitRatio=total?(double)hits/total:0.0;
     cout<<"\n"<<name<<"Cache Stats \n";
+    cout<<"Policy: "<<Policy::name()<<"\n";
     cout<<"Hits: "<<hits<<"\n";
     cout<<"Misses: "<<misses<<"\n";
     cout<<"Hit Ratio: "<<hitRatio<<"\n";
-}
\ No newline at end of file
+}
+
+template<class Policy>
+static void replayPolicy(const vector<unsigned long long>& trace,int size,int blockSize,int assoc,int threads){
+    CacheT<Policy> c(size,blockSize,assoc);
+    c.replay(trace,threads);
+    c.stats("");
+}
+
+void comparePolicies(const vector<unsigned long long>& trace,int size,int blockSize,int assoc,int threads){
+    replayPolicy<FifoPolicy>(trace,size,blockSize,assoc,threads);
+    replayPolicy<LruPolicy>(trace,size,blockSize,assoc,threads);
+    replayPolicy<PlruPolicy>(trace,size,blockSize,assoc,threads);
+    replayPolicy<SrripPolicy>(trace,size,blockSize,assoc,threads);
+    replayPolicy<BrripPolicy>(trace,size,blockSize,assoc,threads);
+    replayPolicy<RandomPolicy>(trace,size,blockSize,assoc,threads);
+    CacheT<OptPolicy> opt(size,blockSize,assoc);
+    opt.policy().prepare(trace,blockSize);
+    opt.replay(trace,threads);
+    opt.stats("");
+}
+
+template class CacheT<FifoPolicy>;
+template class CacheT<LruPolicy>;
+template class CacheT<PlruPolicy>;
+template class CacheT<SrripPolicy>;
+template class CacheT<BrripPolicy>;
+template class CacheT<RandomPolicy>;
+template class CacheT<OptPolicy>;
+
+unique_ptr<CacheBase> makeCache(const string& policy,int size,int blockSize,int assoc){
+    if(policy=="fifo") return unique_ptr<CacheBase>(new CacheT<FifoPolicy>(size,blockSize,assoc));
+    if(policy=="lru") return unique_ptr<CacheBase>(new CacheT<LruPolicy>(size,blockSize,assoc));
+    if(policy=="plru") return unique_ptr<CacheBase>(new CacheT<PlruPolicy>(size,blockSize,assoc));
+    if(policy=="srrip") return unique_ptr<CacheBase>(new CacheT<SrripPolicy>(size,blockSize,assoc));
+    if(policy=="brrip") return unique_ptr<CacheBase>(new CacheT<BrripPolicy>(size,blockSize,assoc));
+    if(policy=="random") return unique_ptr<CacheBase>(new CacheT<RandomPolicy>(size,blockSize,assoc));
+    return nullptr;
+}
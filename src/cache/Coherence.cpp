@@ -0,0 +1,379 @@
+#include "../../include/Coherence.h"
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+enum{EV_MISS,EV_UPGRADE,EV_EVICT};
+
+static const size_t EPOCH=1<<16;
+
+bool checkCoherenceConfig(const HierarchyConfig& cfg,int cores,string& err){
+    if(cores<1 || cores>64){
+        err="coherence needs 1-64 cores";
+        return false;
+    }
+    if(cfg.levels.size()<2){
+        err="coherence needs at least one private level and a shared last level";
+        return false;
+    }
+    for(const CacheLevelConfig& lc:cfg.levels){
+        if(lc.blockSize!=cfg.levels[0].blockSize){
+            err="coherence needs one block size across all levels";
+            return false;
+        }
+    }
+    return true;
+}
+
+CoherentSystem::CoherentSystem(const HierarchyConfig& cfg,int n){
+    string err;
+    if(!checkCoherenceConfig(cfg,n,err)) throw invalid_argument(err);
+    cfgs=cfg.levels;
+    blockSize=cfg.levels[0].blockSize;
+    //Words are the false-sharing granularity; at most 64 per block
+    wordSize=max(cfg.writeSize,(blockSize+63)/64);
+    memoryLatency=cfg.memoryLatency;
+    int priv=cfgs.size()-1;
+    cores.resize(n);
+    for(Core& k:cores){
+        for(int i=0;i<priv;i++){
+            const CacheLevelConfig& lc=cfgs[i];
+            k.levels.push_back(makeCache(lc.policy,lc.size,lc.blockSize,lc.assoc));
+            if(!k.levels.back()) throw invalid_argument("unknown cache policy "+lc.policy);
+        }
+        k.hits.assign(priv,0);
+        k.misses.assign(priv,0);
+    }
+    const CacheLevelConfig& lc=cfgs.back();
+    llc=makeCache(lc.policy,lc.size,lc.blockSize,lc.assoc);
+    if(!llc) throw invalid_argument("unknown cache policy "+lc.policy);
+}
+
+//Removes block from every private level of core
+void CoherentSystem::dropPrivate(int core,unsigned long long block){
+    Core& k=cores[core];
+    bool was;
+    for(unique_ptr<CacheBase>& c:k.levels) c->invalidate(block,was);
+    k.state.erase(block);
+}
+
+//Dirty data leaving a private cache lands in the LLC, or memory if the LLC
+//no longer holds the block
+void CoherentSystem::writeBack(unsigned long long block){
+    if(!llc->setDirty(block)) memWrites++;
+}
+
+//core's copy of block is invalidated by a write to word from another core
+void CoherentSystem::invalidateRemote(int core,unsigned long long block,int word){
+    Core& k=cores[core];
+    auto it=k.state.find(block);
+    if(it!=k.state.end() && it->second==MESI_M){
+        cacheToCache++;
+        writeBack(block);
+    }
+    dropPrivate(core,block);
+    k.lostWords[block]=1ULL<<word;
+    k.invalidationsReceived++;
+    invalidations++;
+    lines[block].invalidations++;
+}
+
+//A write by core to word: remember it for every other core that lost block
+void CoherentSystem::noteWrite(int core,unsigned long long block,int word){
+    auto it=dir.find(block);
+    if(it==dir.end()) return;
+    unsigned long long others=it->second.lost&~(1ULL<<core);
+    while(others){
+        int o=__builtin_ctzll(others);
+        others&=others-1;
+        cores[o].lostWords[block]|=1ULL<<word;
+    }
+}
+
+//Directory transaction for a private miss (or an S->M upgrade) by core.
+//Returns the state core now holds block in.
+MesiState CoherentSystem::request(int core,unsigned long long block,bool write,bool upgrade,int word,MissKind kind){
+    DirEntry& d=dir[block];
+    unsigned long long me=1ULL<<core;
+    bool supplied=false;
+    if(kind!=MISS_OTHER){
+        LineStats& ls=lines[block];
+        if(kind==MISS_TRUE_SHARING) ls.trueSharing++;
+        else ls.falseSharing++;
+    }
+    d.lost&=~me;
+    MesiState st;
+    if(write){
+        unsigned long long others=d.sharers&~me;
+        while(others){
+            int o=__builtin_ctzll(others);
+            others&=others-1;
+            if(cores[o].state[block]==MESI_M) supplied=true;
+            invalidateRemote(o,block,word);
+            d.lost|=1ULL<<o;
+        }
+        d.sharers=me;
+        d.owner=core;
+        st=MESI_M;
+    }else{
+        if(d.owner>=0 && d.owner!=core){
+            //The exclusive owner downgrades to S, writing back if modified
+            unsigned char& os=cores[d.owner].state[block];
+            if(os==MESI_M){
+                supplied=true;
+                cacheToCache++;
+                writeBack(block);
+            }
+            os=MESI_S;
+            d.owner=-1;
+        }
+        d.sharers|=me;
+        if(d.sharers==me){
+            d.owner=core;
+            st=MESI_E;
+        }else{
+            st=MESI_S;
+        }
+    }
+    if(upgrade) return st;
+    sharedCycles+=cfgs.back().latency;
+    if(llc->lookup(block)){
+        llcHits++;
+        return st;
+    }
+    llcMisses++;
+    if(!supplied) sharedCycles+=memoryLatency;
+    unsigned long long victim;
+    bool victimDirty;
+    if(!llc->fill(block,false,victim,victimDirty)) return st;
+    if(cfgs.back().inclusion==INCLUSIVE){
+        auto it=dir.find(victim);
+        if(it!=dir.end()){
+            unsigned long long holders=it->second.sharers;
+            while(holders){
+                int o=__builtin_ctzll(holders);
+                holders&=holders-1;
+                if(cores[o].state[victim]==MESI_M) victimDirty=true;
+                dropPrivate(o,victim);
+                llcBackInvalidations++;
+            }
+            it->second.sharers=0;
+            it->second.owner=-1;
+            if(!it->second.lost) dir.erase(it);
+        }
+    }
+    if(victimDirty) memWrites++;
+    return st;
+}
+
+//core's last private level evicted block
+void CoherentSystem::release(int core,unsigned long long block,bool dirty){
+    auto it=dir.find(block);
+    if(dirty) writeBack(block);
+    if(it==dir.end()) return;
+    DirEntry& d=it->second;
+    d.sharers&=~(1ULL<<core);
+    if(d.owner==core) d.owner=-1;
+    if(!d.sharers && !d.lost) dir.erase(it);
+}
+
+void CoherentSystem::privateFill(int core,int level,unsigned long long addr,bool local,long long idx){
+    Core& k=cores[core];
+    unsigned long long victim;
+    bool vd;
+    if(!k.levels[level]->fill(addr,false,victim,vd)) return;
+    //Private levels are inclusive of the ones above them
+    bool was;
+    for(int up=0;up<level;up++) k.levels[up]->invalidate(victim,was);
+    if(level+1<(int)k.levels.size()) return;
+    auto it=k.state.find(victim);
+    bool dirty=it!=k.state.end() && it->second==MESI_M;
+    if(it!=k.state.end()) k.state.erase(it);
+    if(dirty) k.writebacks++;
+    if(local) k.events.push_back({idx,victim,EV_EVICT,dirty,MISS_OTHER,0});
+    else release(core,victim,dirty);
+}
+
+//One access by core. With local set the caller guarantees no other core
+//holds or touches the block, so directory work is queued in core.events.
+void CoherentSystem::access(int core,unsigned long long addr,bool write,long long idx,bool local){
+    Core& k=cores[core];
+    int p=k.levels.size();
+    unsigned long long block=addr/blockSize*blockSize;
+    int word=(addr%blockSize)/wordSize;
+    k.accesses++;
+    int hit=p;
+    for(int i=0;i<p;i++){
+        k.cycles+=cfgs[i].latency;
+        if(k.levels[i]->lookup(addr)){
+            k.hits[i]++;
+            hit=i;
+            break;
+        }
+        k.misses[i]++;
+    }
+    if(hit<p){
+        for(int i=hit-1;i>=0;i--) privateFill(core,i,addr,local,idx);
+        if(write){
+            unsigned char& st=k.state[block];
+            if(st==MESI_S){
+                k.upgrades++;
+                if(local) k.events.push_back({idx,block,EV_UPGRADE,true,MISS_OTHER,word});
+                else request(core,block,true,true,word,MISS_OTHER);
+            }
+            st=MESI_M;
+        }
+    }else{
+        MissKind kind=MISS_OTHER;
+        auto it=k.lostWords.find(block);
+        if(it!=k.lostWords.end()){
+            if(it->second>>word&1){
+                kind=MISS_TRUE_SHARING;
+                k.trueSharing++;
+            }else{
+                kind=MISS_FALSE_SHARING;
+                k.falseSharing++;
+            }
+            k.lostWords.erase(it);
+        }
+        MesiState st;
+        if(local){
+            st=write?MESI_M:MESI_E;
+            k.events.push_back({idx,block,EV_MISS,write,(unsigned char)kind,word});
+        }else{
+            st=request(core,block,write,false,word,kind);
+        }
+        for(int i=p-1;i>=0;i--) privateFill(core,i,addr,local,idx);
+        k.state[block]=st;
+    }
+    if(write && !local) noteWrite(core,block,word);
+}
+
+MesiState CoherentSystem::state(int core,unsigned long long addr) const{
+    const Core& k=cores[core];
+    auto it=k.state.find(addr/blockSize*blockSize);
+    return it==k.state.end()?MESI_I:(MesiState)it->second;
+}
+
+//True if recs can be split by core: each block is touched by one core only,
+//and no other core holds it or has lost it to a write
+bool CoherentSystem::independent(const vector<TraceRecord>& recs) const{
+    if(cfgs.back().inclusion==INCLUSIVE) return false;
+    unordered_map<unsigned long long,int> toucher;
+    toucher.reserve(recs.size());
+    for(const TraceRecord& r:recs){
+        unsigned long long block=r.addr/blockSize*blockSize;
+        auto ins=toucher.insert({block,r.core});
+        if(!ins.second && ins.first->second!=r.core) return false;
+    }
+    for(const pair<const unsigned long long,int>& t:toucher){
+        auto it=dir.find(t.first);
+        if(it!=dir.end() && ((it->second.sharers|it->second.lost)&~(1ULL<<t.second))) return false;
+    }
+    return true;
+}
+
+void CoherentSystem::runParallel(const vector<TraceRecord>& recs,long long base,int threads){
+    int n=cores.size();
+    vector<thread> workers;
+    for(int t=0;t<threads;t++){
+        workers.emplace_back([this,&recs,base,threads,t](){
+            for(size_t i=0;i<recs.size();i++){
+                int c=recs[i].core;
+                if(c%threads==t) access(c,recs[i].addr,recs[i].write,base+i,true);
+            }
+        });
+    }
+    for(thread& w:workers) w.join();
+    //Apply the deferred directory and LLC work in trace order
+    vector<size_t> next(n,0);
+    for(size_t i=0;i<recs.size();i++){
+        Core& k=cores[recs[i].core];
+        size_t& j=next[recs[i].core];
+        for(;j<k.events.size() && k.events[j].idx==base+(long long)i;j++){
+            const Event& e=k.events[j];
+            if(e.kind==EV_EVICT) release(recs[i].core,e.block,e.write);
+            else request(recs[i].core,e.block,e.kind==EV_UPGRADE || e.write,e.kind==EV_UPGRADE,e.word,(MissKind)e.miss);
+        }
+    }
+    for(Core& k:cores) k.events.clear();
+}
+
+long long CoherentSystem::replay(TraceReader& trace,int threads){
+    static const size_t BATCH=4096;
+    TraceRecord recs[BATCH];
+    vector<TraceRecord> epoch;
+    epoch.reserve(EPOCH);
+    long long total=0;
+    threads=max(1,min(threads,(int)cores.size()));
+    bool more=true;
+    while(more){
+        epoch.clear();
+        while(epoch.size()<EPOCH){
+            size_t n=trace.read(recs,min(BATCH,EPOCH-epoch.size()));
+            if(n==0){
+                more=false;
+                break;
+            }
+            for(size_t i=0;i<n;i++){
+                if(recs[i].core<cores.size()) epoch.push_back(recs[i]);
+                else badCores++;
+            }
+        }
+        if(epoch.empty()) break;
+        epochs++;
+        if(threads>1 && independent(epoch)){
+            parallelEpochs++;
+            runParallel(epoch,total,threads);
+        }else{
+            for(size_t i=0;i<epoch.size();i++) access(epoch[i].core,epoch[i].addr,epoch[i].write,total+i,false);
+        }
+        total+=epoch.size();
+    }
+    return total;
+}
+
+void CoherentSystem::stats(){
+    int p=cfgs.size()-1;
+    long long accesses=0,cycles=sharedCycles,upgrades=0,trueSharing=0,falseSharing=0;
+    std::cout<<"Cores: "<<cores.size()<<" (private";
+    for(int i=0;i<p;i++) std::cout<<" "<<cfgs[i].name;
+    std::cout<<", shared "<<cfgs.back().name<<" with a MESI directory)\n";
+    for(size_t c=0;c<cores.size();c++){
+        const Core& k=cores[c];
+        std::cout<<"Core "<<c<<": "<<k.accesses<<" accesses";
+        for(int i=0;i<p;i++) std::cout<<", "<<cfgs[i].name<<" "<<k.hits[i]<<"/"<<k.misses[i]<<" hits/misses";
+        std::cout<<", "<<k.trueSharing+k.falseSharing<<" coherence misses ("<<k.falseSharing<<" false sharing), ";
+        std::cout<<k.upgrades<<" upgrades, "<<k.invalidationsReceived<<" invalidations received, "<<k.writebacks<<" writebacks\n";
+        accesses+=k.accesses;
+        cycles+=k.cycles;
+        upgrades+=k.upgrades;
+        trueSharing+=k.trueSharing;
+        falseSharing+=k.falseSharing;
+    }
+    std::cout<<cfgs.back().name<<" hits: "<<llcHits<<"\n";
+    std::cout<<cfgs.back().name<<" misses: "<<llcMisses<<"\n";
+    std::cout<<"Coherence misses: "<<trueSharing+falseSharing<<" (true sharing "<<trueSharing<<", false sharing "<<falseSharing<<")\n";
+    std::cout<<"Invalidations: "<<invalidations<<", upgrades: "<<upgrades<<", cache-to-cache transfers: "<<cacheToCache<<"\n";
+    std::cout<<"LLC back-invalidations: "<<llcBackInvalidations<<", memory writebacks: "<<memWrites<<"\n";
+    double amat=accesses?(double)cycles/accesses:0.0;
+    std::cout<<"AMAT: "<<amat<<" cycles (memory "<<memoryLatency<<" cycles)\n";
+    std::cout<<"Epochs: "<<epochs<<" ("<<parallelEpochs<<" run in parallel)\n";
+    if(badCores) std::cout<<"Skipped "<<badCores<<" records for cores outside 0-"<<cores.size()-1<<"\n";
+
+    vector<pair<unsigned long long,LineStats>> hot;
+    for(const pair<const unsigned long long,LineStats>& l:lines) hot.push_back(l);
+    auto hotter=[](const pair<unsigned long long,LineStats>& a,const pair<unsigned long long,LineStats>& b){
+        if(a.second.falseSharing!=b.second.falseSharing) return a.second.falseSharing>b.second.falseSharing;
+        if(a.second.invalidations!=b.second.invalidations) return a.second.invalidations>b.second.invalidations;
+        return a.first<b.first;
+    };
+    size_t top=min<size_t>(10,hot.size());
+    partial_sort(hot.begin(),hot.begin()+top,hot.end(),hotter);
+    if(top) std::cout<<"Hottest shared lines:\n";
+    for(size_t i=0;i<top;i++){
+        const LineStats& s=hot[i].second;
+        std::cout<<"  line "<<hot[i].first<<": "<<s.falseSharing<<" false sharing misses, "<<s.trueSharing<<" true sharing misses, "<<s.invalidations<<" invalidations\n";
+    }
+}
@@ -1,28 +1,417 @@
 #include "../../include/MultilevelCache.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <climits>
+#include <cstdlib>
+#include <stdexcept>
 
-MultilevelCache::MultilevelCache(Cache& l1,Cache& l2):L1(l1),L2(l2){}
+HierarchyConfig defaultHierarchyConfig(){
+    HierarchyConfig cfg;
+    cfg.levels.push_back({"L1",4,4,1,"fifo",1,NINE});
+    cfg.levels.push_back({"L2",16,4,1,"fifo",10,NINE});
+    cfg.memoryLatency=100;
+    return cfg;
+}
+
+bool loadHierarchyConfig(const string& path,HierarchyConfig& cfg,string& err){
+    ifstream in(path);
+    if(!in.is_open()){
+        err="could not open "+path;
+        return false;
+    }
+    cfg.levels.clear();
+    cfg.memoryLatency=100;
+    string line;
+    int lineNo=0;
+    while(getline(in,line)){
+        lineNo++;
+        size_t hash=line.find('#');
+        if(hash!=string::npos) line.erase(hash);
+        stringstream ss(line);
+        string key;
+        if(!(ss>>key)) continue;
+        string where=path+":"+to_string(lineNo)+": ";
+        if(key=="memory_latency"){
+            if(!(ss>>cfg.memoryLatency) || cfg.memoryLatency<0){
+                err=where+"expected memory_latency <cycles>";
+                return false;
+            }
+        }else if(key=="write_size"){
+            if(!(ss>>cfg.writeSize) || cfg.writeSize<=0){
+                err=where+"expected write_size <bytes>";
+                return false;
+            }
+        }else if(key=="level"){
+            CacheLevelConfig lc;
+            lc.inclusion=NINE;
+            if(!(ss>>lc.name>>lc.size>>lc.blockSize>>lc.assoc>>lc.policy>>lc.latency)){
+                err=where+"expected level <name> <size> <blockSize> <assoc> <policy> <latency> [options]";
+                return false;
+            }
+            string opt;
+            while(ss>>opt){
+                if(opt=="inclusive") lc.inclusion=INCLUSIVE;
+                else if(opt=="exclusive") lc.inclusion=EXCLUSIVE;
+                else if(opt=="nine") lc.inclusion=NINE;
+                else if(opt=="write-back") lc.writeBack=true;
+                else if(opt=="write-through") lc.writeBack=false;
+                else if(opt=="write-allocate") lc.writeAllocate=true;
+                else if(opt=="no-write-allocate") lc.writeAllocate=false;
+                else if(opt.compare(0,13,"write-buffer=")==0){
+                    char* end;
+                    long v=strtol(opt.c_str()+13,&end,10);
+                    if(*end || end==opt.c_str()+13 || v<0 || v>4096){
+                        err=where+"write-buffer needs 0-4096 entries";
+                        return false;
+                    }
+                    lc.writeBuffer=v;
+                }else if(opt.compare(0,9,"prefetch=")==0){
+                    //prefetch=<kind>[:<degree>[:<distance>]]
+                    stringstream ps(opt.substr(9));
+                    string degree,distance;
+                    getline(ps,lc.prefetch,':');
+                    if(getline(ps,degree,':')) lc.prefetchDegree=atoi(degree.c_str());
+                    if(getline(ps,distance,':')) lc.prefetchDistance=atoi(distance.c_str());
+                    if(!makePrefetcher(lc.prefetch,64,1,1)){
+                        err=where+"unknown prefetcher '"+lc.prefetch+"' (nextline, stride or stream)";
+                        return false;
+                    }
+                    if(lc.prefetchDegree<1 || lc.prefetchDegree>64 || lc.prefetchDistance<1 || lc.prefetchDistance>1024){
+                        err=where+"prefetch degree must be 1-64 and distance 1-1024";
+                        return false;
+                    }
+                }else{
+                    err=where+"unknown level option '"+opt+"'";
+                    return false;
+                }
+            }
+            if(!lc.prefetch.empty() && lc.inclusion==EXCLUSIVE){
+                err=where+"an exclusive level only takes victims and cannot prefetch";
+                return false;
+            }
+            if(lc.blockSize<=0 || lc.assoc<1 || lc.assoc>64 || lc.size<lc.blockSize*lc.assoc){
+                err=where+"level "+lc.name+" needs blockSize > 0, 1-64 ways and size >= blockSize*assoc";
+                return false;
+            }
+            if(!makeCache(lc.policy,lc.blockSize*lc.assoc,lc.blockSize,lc.assoc)){
+                err=where+"unknown policy '"+lc.policy+"'";
+                return false;
+            }
+            cfg.levels.push_back(lc);
+        }else{
+            err=where+"unknown key '"+key+"'";
+            return false;
+        }
+    }
+    if(cfg.levels.empty()){
+        err=path+": no cache levels defined";
+        return false;
+    }
+    if(cfg.levels[0].inclusion==EXCLUSIVE){
+        err=path+": the first level cannot be exclusive";
+        return false;
+    }
+    return true;
+}
+
+MultilevelCache::MultilevelCache(const HierarchyConfig& cfg){
+    memoryLatency=cfg.memoryLatency;
+    writeSize=cfg.writeSize;
+    for(const CacheLevelConfig& lc:cfg.levels){
+        Level l;
+        l.cache=makeCache(lc.policy,lc.size,lc.blockSize,lc.assoc);
+        if(!l.cache) throw invalid_argument("unknown cache policy "+lc.policy);
+        if(!lc.prefetch.empty()){
+            l.prefetcher=makePrefetcher(lc.prefetch,lc.blockSize,lc.prefetchDegree,lc.prefetchDistance);
+            if(!l.prefetcher) throw invalid_argument("unknown prefetcher "+lc.prefetch);
+        }
+        l.cfg=lc;
+        levels.push_back(move(l));
+    }
+}
+
+//Removes addr's block from level, whether it was invalidated or moved out by
+//an exclusive fill. A prefetched block leaving before its first use is
+//unused. Returns true if the block was resident.
+bool MultilevelCache::dropLine(int level,unsigned long long addr,bool& dirty){
+    Level& l=levels[level];
+    if(!l.cache->invalidate(addr,dirty)) return false;
+    if(!l.pending.empty() && l.pending.erase(addr/l.cfg.blockSize*l.cfg.blockSize)) l.pfUnused++;
+    return true;
+}
+
+//An inclusive level lost victim: drop every copy of it above. Returns true
+//if any of those copies was dirty, so the eviction carries their data down.
+bool MultilevelCache::backInvalidate(int level,unsigned long long victim){
+    int bs=levels[level].cfg.blockSize;
+    bool dirty=false,was;
+    for(int up=0;up<level;up++){
+        int ubs=levels[up].cfg.blockSize;
+        if(ubs>=bs){
+            dropLine(up,victim,was);
+            dirty|=was;
+        }else{
+            for(unsigned long long a=victim;a<victim+bs;a+=ubs){
+                dropLine(up,a,was);
+                dirty|=was;
+            }
+        }
+    }
+    return dirty;
+}
+
+//victim was evicted from level-1 into the exclusive level below it
+void MultilevelCache::insertVictim(int level,unsigned long long victim,bool dirty){
+    Level& l=levels[level];
+    bool was;
+    dropLine(level,victim,was);
+    dirty|=was;
+    if(dirty && !l.cfg.writeBack){
+        sendDown(level,victim,l.cfg.blockSize);
+        dirty=false;
+    }
+    unsigned long long v;
+    bool vd;
+    if(l.cache->fill(victim,dirty,v,vd)) evicted(level,v,vd);
+}
+
+//victim left level: an exclusive level below catches it, otherwise only a
+//dirty line has anything to write back
+void MultilevelCache::evicted(int level,unsigned long long victim,bool dirty){
+    Level& l=levels[level];
+    if(dirty) l.dirtyEvictions++;
+    if(level+1<(int)levels.size() && levels[level+1].cfg.inclusion==EXCLUSIVE){
+        l.bytesOut+=l.cfg.blockSize;
+        insertVictim(level+1,victim,dirty);
+    }else if(dirty){
+        sendDown(level,victim,l.cfg.blockSize);
+    }
+}
+
+void MultilevelCache::fillLevel(int level,unsigned long long addr,bool prefetch){
+    Level& l=levels[level];
+    unsigned long long victim;
+    bool dirty;
+    l.bytesIn+=l.cfg.blockSize;
+    if(!l.cache->fill(addr,false,victim,dirty)) return;
+    if(l.prefetcher){
+        if(l.pending.erase(victim)){
+            l.pfUnused++;
+        }else if(prefetch){
+            if(l.displaced.size()>=(size_t)(l.cfg.size/l.cfg.blockSize)) l.displaced.clear();
+            l.displaced.insert(victim);
+        }
+    }
+    if(l.cfg.inclusion==INCLUSIVE && backInvalidate(level,victim)) dirty=true;
+    evicted(level,victim,dirty);
+}
+
+//Data leaving level for the one below, through the level's write buffer if
+//it has one. A full buffer drains its oldest entry to make room.
+void MultilevelCache::sendDown(int level,unsigned long long addr,int bytes){
+    Level& l=levels[level];
+    if(l.cfg.writeBuffer==0){
+        l.bytesOut+=bytes;
+        deliver(level+1,addr,bytes);
+        return;
+    }
+    unsigned long long block=addr/l.cfg.blockSize*l.cfg.blockSize;
+    for(pair<unsigned long long,int>& e:l.buffer){
+        if(e.first==block){
+            e.second=min(e.second+bytes,l.cfg.blockSize);
+            l.coalesced++;
+            return;
+        }
+    }
+    if((int)l.buffer.size()==l.cfg.writeBuffer){
+        pair<unsigned long long,int> e=l.buffer.front();
+        l.buffer.erase(l.buffer.begin());
+        l.bytesOut+=e.second;
+        deliver(level+1,e.first,e.second);
+    }
+    l.buffer.push_back({block,bytes});
+}
 
-void MultilevelCache::access(int addr){
-    if(L1.access(addr)){
-        l1_hit++;
-        std::cout<<addr<<" Found in L1 cache\n";
-        return;        
+//Written data arriving at level from above. A resident line absorbs it
+//(write-back) or passes it on (write-through); a missing one lets it through
+//without allocating.
+void MultilevelCache::deliver(int level,unsigned long long addr,int bytes){
+    if(level==(int)levels.size()){
+        memWriteBytes+=bytes;
+        return;
     }
-    l1_miss++;
-    if(L2.access(addr)){
-        l2_hit++;
-        std::cout<<addr<<" Found in L2 cache\n";
+    Level& l=levels[level];
+    if(bytes>l.cfg.blockSize){
+        for(int off=0;off<bytes;off+=l.cfg.blockSize) deliver(level,addr+off,min(l.cfg.blockSize,bytes-off));
+        return;
+    }
+    if(!l.cache->contains(addr)){
+        deliver(level+1,addr,bytes);
+    }else if(l.cfg.writeBack){
+        l.cache->setDirty(addr);
     }else{
-        l2_miss++;
-        std::cout<<addr<<" Not found in L1 and L2 cache\n";
+        sendDown(level,addr,bytes);
+    }
+}
+
+//Brings addr's block into level ahead of demand. Its data arrives after the
+//latency of the level that holds it below (or memory). Like a demand miss,
+//the fill also lands in every non-exclusive level in between, and an
+//exclusive source gives the block up.
+void MultilevelCache::prefetch(int level,unsigned long long addr){
+    Level& l=levels[level];
+    unsigned long long block=addr/l.cfg.blockSize*l.cfg.blockSize;
+    if(l.cache->contains(block)) return;
+    int n=levels.size();
+    long long lat=0;
+    int src=level+1;
+    for(;src<n;src++){
+        lat+=levels[src].cfg.latency;
+        if(levels[src].cache->contains(block)) break;
+    }
+    int lowest=level;
+    for(int i=src-1;i>level;i--){
+        if(levels[i].cfg.inclusion!=EXCLUSIVE){
+            lowest=i;
+            break;
+        }
+    }
+    bool movedDirty=false;
+    if(src<n && levels[src].cfg.inclusion==EXCLUSIVE) dropLine(src,block,movedDirty);
+    if(src==n){
+        lat+=memoryLatency;
+        memReadBytes+=levels[lowest].cfg.blockSize;
+    }
+    l.pfIssued++;
+    //Bottom-up, as on a demand miss
+    for(int i=lowest;i>=level;i--){
+        if(i==level || levels[i].cfg.inclusion!=EXCLUSIVE) fillLevel(i,block,true);
+    }
+    if(movedDirty) deliver(lowest,block,levels[src].cfg.blockSize);
+    l.pending[block]=cycles+lat;
+}
+
+int MultilevelCache::lookup(unsigned long long addr,bool write,unsigned long long pc){
+    int n=levels.size();
+    int hit=n;
+    accesses++;
+    if(write) writes++;
+    for(int i=0;i<n;i++){
+        Level& l=levels[i];
+        cycles+=l.cfg.latency;
+        if(l.cache->lookup(addr)){
+            l.hits++;
+            hit=i;
+            if(!l.pending.empty()){
+                //First demand use of a prefetched block; late if its data is
+                //still on the way, and the access waits for it
+                auto it=l.pending.find(addr/l.cfg.blockSize*l.cfg.blockSize);
+                if(it!=l.pending.end()){
+                    if(it->second>cycles){
+                        l.pfLate++;
+                        cycles=it->second;
+                    }else{
+                        l.pfUseful++;
+                    }
+                    l.pending.erase(it);
+                }
+            }
+            break;
+        }
+        l.misses++;
+        if(!l.displaced.empty() && l.displaced.erase(addr/l.cfg.blockSize*l.cfg.blockSize)) l.pfPolluting++;
+    }
+    if(hit==n) cycles+=memoryLatency;
+    //Levels above the hit that take the block: exclusive levels never do, and
+    //a write miss skips no-write-allocate levels
+    int lowest=-1;
+    for(int i=hit-1;i>=0;i--){
+        if((i==0 || levels[i].cfg.inclusion!=EXCLUSIVE) && (!write || levels[i].cfg.writeAllocate)){
+            lowest=i;
+            break;
+        }
+    }
+    //An exclusive level gives the block up to the levels above
+    bool movedDirty=false;
+    if(hit<n && lowest>=0 && levels[hit].cfg.inclusion==EXCLUSIVE) dropLine(hit,addr,movedDirty);
+    if(hit==n && lowest>=0) memReadBytes+=levels[lowest].cfg.blockSize;
+    //Fill bottom-up so back-invalidations land before the upper fills
+    for(int i=lowest;i>=0;i--){
+        if((i==0 || levels[i].cfg.inclusion!=EXCLUSIVE) && (!write || levels[i].cfg.writeAllocate)) fillLevel(i,addr);
+    }
+    if(movedDirty) deliver(lowest,addr,levels[hit].cfg.blockSize);
+    if(write){
+        if(levels[0].cache->contains(addr)) deliver(0,addr,writeSize);
+        else sendDown(0,addr,writeSize);
+    }
+    //Every level the access reached trains its prefetcher
+    for(int i=0;i<n && i<=hit;i++){
+        if(!levels[i].prefetcher) continue;
+        pfCands.clear();
+        levels[i].prefetcher->observe(addr,pc,i==hit,pfCands);
+        for(unsigned long long c:pfCands) prefetch(i,c);
     }
+    return hit;
+}
+
+void MultilevelCache::access(unsigned long long addr,bool write){
+    int level=lookup(addr,write);
+    if(level<(int)levels.size()){
+        std::cout<<addr<<" Found in "<<levels[level].cfg.name<<" cache\n";
+        return;
+    }
+    std::cout<<addr<<" Not found in ";
+    for(size_t i=0;i<levels.size();i++){
+        std::cout<<(i?" and ":"")<<levels[i].cfg.name;
+    }
+    std::cout<<" cache\n";
+}
+
+long long MultilevelCache::replay(TraceReader& trace){
+    static const size_t BATCH=4096;
+    TraceRecord recs[BATCH];
+    long long total=0;
+    size_t n;
+    while((n=trace.read(recs,BATCH))>0){
+        for(size_t i=0;i<n;i++) lookup(recs[i].addr,recs[i].write,recs[i].pc);
+        total+=n;
+    }
+    return total;
 }
 
 void MultilevelCache::cacheStats(){
-    std::cout<<"L1 hits: "<<l1_hit<<"\n";
-    std::cout<<"L1 misses: "<<l1_miss<<"\n";
-    std::cout<<"L2 hits: "<<l2_hit<<"\n";
-    std::cout<<"L2 misses: "<<l2_miss<<"\n";
-}
\ No newline at end of file
+    for(const Level& l:levels){
+        std::cout<<l.cfg.name<<" hits: "<<l.hits<<"\n";
+        std::cout<<l.cfg.name<<" misses: "<<l.misses<<"\n";
+    }
+    for(const Level& l:levels){
+        long long total=l.hits+l.misses;
+        double missRate=total?(double)l.misses/total:0.0;
+        std::cout<<l.cfg.name<<" local miss rate: "<<missRate<<" ("<<l.cache->policyName()<<", "<<l.cfg.latency<<" cycles)\n";
+    }
+    for(const Level& l:levels){
+        std::cout<<l.cfg.name<<" "<<(l.cfg.writeBack?"write-back":"write-through")<<", "<<(l.cfg.writeAllocate?"write-allocate":"no-write-allocate");
+        std::cout<<": "<<l.dirtyEvictions<<" dirty evictions, "<<l.bytesIn<<" bytes in, "<<l.bytesOut<<" bytes out";
+        if(l.cfg.writeBuffer) std::cout<<", write buffer "<<l.buffer.size()<<"/"<<l.cfg.writeBuffer<<" pending, "<<l.coalesced<<" coalesced";
+        std::cout<<"\n";
+    }
+    for(const Level& l:levels){
+        if(!l.prefetcher) continue;
+        long long used=l.pfUseful+l.pfLate;
+        double accuracy=l.pfIssued?(double)used/l.pfIssued:0.0;
+        double coverage=used+l.misses?(double)used/(used+l.misses):0.0;
+        std::cout<<l.cfg.name<<" prefetch ("<<l.prefetcher->name()<<", degree "<<l.cfg.prefetchDegree<<", distance "<<l.cfg.prefetchDistance<<"): ";
+        std::cout<<l.pfIssued<<" issued, "<<l.pfUseful<<" useful, "<<l.pfLate<<" late, "<<l.pfUnused<<" unused, "<<l.pfPolluting<<" polluting";
+        std::cout<<", accuracy "<<accuracy<<", coverage "<<coverage<<"\n";
+    }
+    std::cout<<"Memory traffic: "<<memReadBytes<<" bytes read, "<<memWriteBytes<<" bytes written ("<<writes<<" of "<<accesses<<" accesses were writes)\n";
+    double amat=accesses?(double)cycles/accesses:0.0;
+    std::cout<<"AMAT: "<<amat<<" cycles (memory "<<memoryLatency<<" cycles)\n";
+}
+
+#ifdef MEMSIM_INSTRUMENT
+void MultilevelCache::missHeatmaps() const{
+    for(const Level& l:levels) l.cache->missHeatmap(l.cfg.name);
+}
+#endif
@@ -0,0 +1,114 @@
+#include "../../include/Prefetcher.h"
+#include <climits>
+
+NextLinePrefetcher::NextLinePrefetcher(int blockSize,int degree,int distance){
+    this->blockSize=blockSize;
+    this->degree=degree;
+    this->distance=distance;
+}
+
+void NextLinePrefetcher::observe(unsigned long long addr,unsigned long long,bool hit,vector<unsigned long long>& out){
+    if(hit) return;
+    unsigned long long block=addr/blockSize;
+    //Blocks past the top of the address space would wrap to block 0
+    unsigned long long room=ULLONG_MAX/blockSize-block;
+    for(int i=0;i<degree && (unsigned long long)(distance+i)<=room;i++) out.push_back((block+distance+i)*blockSize);
+}
+
+StridePrefetcher::StridePrefetcher(int blockSize,int degree,int distance){
+    this->blockSize=blockSize;
+    this->degree=degree;
+    this->distance=distance;
+    table.assign(TABLE,Entry{0,0,0,0,false});
+}
+
+void StridePrefetcher::observe(unsigned long long addr,unsigned long long pc,bool,vector<unsigned long long>& out){
+    unsigned long long key=pc?pc:addr>>REGION_SHIFT;
+    Entry& e=table[(key*0x9e3779b97f4a7c15ULL)>>56];
+    if(!e.valid || e.key!=key){
+        e=Entry{key,addr,0,0,true};
+        return;
+    }
+    long long stride=(long long)(addr-e.last);
+    if(stride!=0 && stride==e.stride){
+        if(e.confidence<3) e.confidence++;
+    }else{
+        e.confidence=0;
+        e.stride=stride;
+    }
+    e.last=addr;
+    if(e.confidence<1) return;
+    //Strides shorter than a block would prefetch the same block repeatedly
+    long long step=e.stride;
+    if(step>0 && step<blockSize) step=blockSize;
+    if(step<0 && -step<blockSize) step=-blockSize;
+    //Candidates run further in one direction, so the first to leave the
+    //address space ends the batch instead of wrapping around
+    for(int i=0;i<degree;i++){
+        long long off;
+        unsigned long long cand;
+        if(__builtin_mul_overflow(step,(long long)(distance+i),&off)) break;
+        if(off>=0?__builtin_add_overflow(addr,(unsigned long long)off,&cand):__builtin_sub_overflow(addr,-(unsigned long long)off,&cand)) break;
+        out.push_back(cand);
+    }
+}
+
+StreamPrefetcher::StreamPrefetcher(int blockSize,int degree,int distance){
+    this->blockSize=blockSize;
+    this->degree=degree;
+    this->distance=distance;
+    streams.assign(STREAMS,Stream{0,0,1,0,false});
+}
+
+void StreamPrefetcher::observe(unsigned long long addr,unsigned long long,bool hit,vector<unsigned long long>& out){
+    tick++;
+    long long block=addr/blockSize;
+    Stream* s=nullptr;
+    for(Stream& st:streams){
+        if(!st.valid) continue;
+        long long d=(block-(long long)st.next)*st.dir;
+        if(d>=0 && d<=distance+degree){
+            s=&st;
+            break;
+        }
+    }
+    if(!s){
+        if(hit) return;
+        //A miss right next to a recent miss starts a stream in that direction
+        int dir=0;
+        for(unsigned long long m:recentMisses){
+            if((long long)m==block-1) dir=1;
+            else if((long long)m==block+1) dir=-1;
+        }
+        if(recentMisses.size()<HISTORY) recentMisses.push_back(block);
+        else recentMisses[tick%HISTORY]=block;
+        if(!dir) return;
+        s=&streams[0];
+        for(Stream& st:streams){
+            if(!st.valid){
+                s=&st;
+                break;
+            }
+            if(st.lastUse<s->lastUse) s=&st;
+        }
+        *s=Stream{(unsigned long long)(block+dir),(unsigned long long)(block+dir),dir,tick,true};
+    }
+    s->next=block+s->dir;
+    s->lastUse=tick;
+    //Issue up to degree blocks that are not already ahead of the head
+    long long start=block+(long long)s->dir*distance;
+    for(int i=0;i<degree;i++){
+        long long cand=start+(long long)s->dir*i;
+        if((cand-(long long)s->head)*s->dir<0) continue;
+        if(cand<0 || (unsigned long long)cand>ULLONG_MAX/blockSize) break;
+        out.push_back((unsigned long long)cand*blockSize);
+        s->head=cand+s->dir;
+    }
+}
+
+unique_ptr<Prefetcher> makePrefetcher(const string& kind,int blockSize,int degree,int distance){
+    if(kind=="nextline") return unique_ptr<Prefetcher>(new NextLinePrefetcher(blockSize,degree,distance));
+    if(kind=="stride") return unique_ptr<Prefetcher>(new StridePrefetcher(blockSize,degree,distance));
+    if(kind=="stream") return unique_ptr<Prefetcher>(new StreamPrefetcher(blockSize,degree,distance));
+    return nullptr;
+}
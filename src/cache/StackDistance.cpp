@@ -0,0 +1,164 @@
+#include "../../include/StackDistance.h"
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+static const unsigned NO_BLOCK=~0u;
+
+//0-based Fenwick tree: tree[i] covers slots (i&(i+1))..i
+static void fenwickAdd(vector<int>& t,int i,int v){
+    for(int n=t.size();i<n;i|=i+1) t[i]+=v;
+}
+
+static int fenwickPrefix(const vector<int>& t,int i){
+    int s=0;
+    for(;i>=0;i=(i&(i+1))-1) s+=t[i];
+    return s;
+}
+
+CacheSweep::CacheSweep(const vector<int>& blockSizes,long long minSize,long long maxSize,int maxAssoc){
+    this->minSize=minSize;
+    this->maxSize=maxSize;
+    this->maxAssoc=maxAssoc;
+    for(int b:blockSizes){
+        Granule gr;
+        gr.blockSize=b;
+        long long maxSets=max(1LL,maxSize/b);
+        //Set counts, distances and the fully associative histogram are int-indexed
+        if(maxSets>INT_MAX/2) throw invalid_argument("Sweep holds 2^30 or more lines of one block size");
+        Geometry full;
+        full.sets=1;
+        full.cap=maxSets;
+        gr.geoms.push_back(full);
+        for(long long s=max(2LL,minSize/((long long)b*maxAssoc));s<=maxSets;s<<=1){
+            Geometry g;
+            g.sets=s;
+            g.cap=maxAssoc;
+            gr.geoms.push_back(g);
+        }
+        for(Geometry& g:gr.geoms){
+            g.stacks.resize(g.sets);
+            g.hist.assign(g.cap+1,0);
+        }
+        granules.push_back(move(gr));
+    }
+}
+
+//The set's clock ran into its capacity: move the live slots to the front,
+//in order, and grow the tree if it is more than half full
+void CacheSweep::compact(SetStack& st,vector<int>& slots,int stride,int g){
+    int cap=st.owner.size();
+    int newCap=cap?cap:8;
+    if(st.live*2>cap) newCap=max(8,cap*2);
+    vector<unsigned> owner(newCap,NO_BLOCK);
+    int j=0;
+    for(int s=0;s<st.clock;s++){
+        if(st.owner[s]==NO_BLOCK) continue;
+        owner[j]=st.owner[s];
+        slots[(size_t)owner[j]*stride+g]=j;
+        j++;
+    }
+    st.owner.swap(owner);
+    st.tree.assign(newCap,0);
+    for(int i=0;i<newCap;i++){
+        if(i<j) st.tree[i]+=1;
+        int p=i|(i+1);
+        if(p<newCap) st.tree[p]+=st.tree[i];
+    }
+    st.clock=j;
+}
+
+//Moves block id to the top of its set's stack; returns its stack distance,
+//or -1 on its first access to this geometry
+int CacheSweep::touch(SetStack& st,vector<int>& slots,int stride,int g,unsigned id,int oldSlot){
+    int d=-1;
+    if(oldSlot>=0){
+        d=st.live-fenwickPrefix(st.tree,oldSlot);
+        fenwickAdd(st.tree,oldSlot,-1);
+        st.owner[oldSlot]=NO_BLOCK;
+        st.live--;
+    }
+    if(st.clock==(int)st.owner.size()) compact(st,slots,stride,g);
+    int s=st.clock++;
+    fenwickAdd(st.tree,s,1);
+    st.owner[s]=id;
+    st.live++;
+    slots[(size_t)id*stride+g]=s;
+    return d;
+}
+
+void CacheSweep::access(unsigned long long addr){
+    accesses++;
+    for(Granule& gr:granules){
+        unsigned long long block=addr/gr.blockSize;
+        auto ins=gr.ids.emplace(block,(unsigned)gr.ids.size());
+        unsigned id=ins.first->second;
+        int stride=gr.geoms.size();
+        if(ins.second){
+            gr.slots.insert(gr.slots.end(),stride,-1);
+            gr.cold++;
+        }
+        for(int g=0;g<stride;g++){
+            Geometry& ge=gr.geoms[g];
+            SetStack& st=ge.stacks[block&(ge.sets-1)];
+            int d=touch(st,gr.slots,stride,g,id,gr.slots[(size_t)id*stride+g]);
+            if(d>=0) ge.hist[min(d,ge.cap)]++;
+        }
+    }
+}
+
+long long CacheSweep::replay(TraceReader& trace){
+    static const size_t BATCH=4096;
+    TraceRecord recs[BATCH];
+    long long total=0;
+    size_t n;
+    while((n=trace.read(recs,BATCH))>0){
+        for(size_t i=0;i<n;i++) access(recs[i].addr);
+        total+=n;
+    }
+    return total;
+}
+
+vector<SweepPoint> CacheSweep::curve() const{
+    vector<SweepPoint> pts;
+    for(const Granule& gr:granules){
+        //atLeast[g][a] = accesses with distance >= a in geometry g
+        vector<vector<long long>> atLeast;
+        for(const Geometry& ge:gr.geoms){
+            vector<long long> suf(ge.cap+2,0);
+            for(int d=ge.cap;d>=0;d--) suf[d]=suf[d+1]+ge.hist[d];
+            atLeast.push_back(suf);
+        }
+        auto point=[&](int g,int assoc,int ways,long long size){
+            long long misses=gr.cold+atLeast[g][ways];
+            pts.push_back({gr.blockSize,gr.geoms[g].sets,assoc,size,misses,accesses?(double)misses/accesses:0.0});
+        };
+        for(long long size=minSize;size<=maxSize;size<<=1){
+            if(size<gr.blockSize) continue;
+            long long lines=size/gr.blockSize;
+            for(int a=1;a<=maxAssoc && a<=lines;a<<=1){
+                long long sets=lines/a;
+                if(sets==1){
+                    point(0,a,a,size);
+                    continue;
+                }
+                for(size_t g=1;g<gr.geoms.size();g++){
+                    if(gr.geoms[g].sets==sets) point(g,a,a,size);
+                }
+            }
+            if(lines>maxAssoc) point(0,0,lines,size);
+        }
+    }
+    return pts;
+}
+
+void CacheSweep::printCurves() const{
+    std::cout<<"block,sets,assoc,size,misses,miss_ratio\n";
+    for(const SweepPoint& p:curve()){
+        std::cout<<p.blockSize<<","<<p.sets<<",";
+        if(p.assoc) std::cout<<p.assoc;
+        else std::cout<<"full";
+        std::cout<<","<<p.size<<","<<p.misses<<","<<p.missRatio<<"\n";
+    }
+}
@@ -0,0 +1,217 @@
+#include "../../include/Instrumentation.h"
+#include <fstream>
+using namespace std;
+
+#ifdef MEMSIM_INSTRUMENT
+#include <algorithm>
+#include <iomanip>
+
+atomic<uint64_t> instrCounters[INSTR_COUNTERS];
+LogHistogram instrHistograms[INSTR_HISTOGRAMS];
+
+#define MEMSIM_NAME(id, name) name,
+static const char *COUNTER_NAMES[] = {MEMSIM_COUNTERS(MEMSIM_NAME)};
+static const char *HISTOGRAM_NAMES[] = {MEMSIM_HISTOGRAMS(MEMSIM_NAME)};
+#undef MEMSIM_NAME
+
+// Event ring. Each slot is a seqlock: the writer of event i stores 2i+1
+// before the fields and 2i+2 after them, so the exporter skips slots that
+// are being written or were overwritten while it read them. The fields are
+// relaxed atomics so that those racing reads are defined.
+static const size_t RING_SIZE = 1 << 16;
+
+struct EventSlot
+{
+    atomic<uint64_t> seq;
+    atomic<const char *> name;
+    atomic<const char *> cat;
+    atomic<const char *> argName;
+    atomic<uint64_t> start, dur, arg;
+    atomic<uint32_t> tid;
+};
+
+static EventSlot ring[RING_SIZE];
+static atomic<uint64_t> ringHead(0);
+static atomic<uint32_t> nextTid(0);
+
+static uint32_t threadId()
+{
+    static thread_local uint32_t tid = nextTid.fetch_add(1, memory_order_relaxed);
+    return tid;
+}
+
+uint64_t instrNow()
+{
+    static const chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+}
+
+void recordEvent(const char *name, const char *cat, uint64_t start, uint64_t dur, const char *argName, uint64_t arg)
+{
+    uint64_t i = ringHead.fetch_add(1, memory_order_relaxed);
+    EventSlot &e = ring[i & (RING_SIZE - 1)];
+    e.seq.store(2 * i + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e.name.store(name, memory_order_relaxed);
+    e.cat.store(cat, memory_order_relaxed);
+    e.argName.store(argName, memory_order_relaxed);
+    e.start.store(start, memory_order_relaxed);
+    e.dur.store(dur, memory_order_relaxed);
+    e.arg.store(arg, memory_order_relaxed);
+    e.tid.store(threadId(), memory_order_relaxed);
+    e.seq.store(2 * i + 2, memory_order_release);
+}
+
+void LogHistogram::reset()
+{
+    for (atomic<uint64_t> &b : buckets)
+        b.store(0, memory_order_relaxed);
+    total.store(0, memory_order_relaxed);
+    sum.store(0, memory_order_relaxed);
+    maxValue.store(0, memory_order_relaxed);
+}
+
+void LogHistogram::print(ostream &out, const char *name) const
+{
+    uint64_t n = count();
+    if (n == 0)
+        return;
+    uint64_t b[65], peak = 0;
+    for (int i = 0; i < 65; i++)
+        peak = max(peak, b[i] = buckets[i].load(memory_order_relaxed));
+    // Percentiles are the upper bound of the bucket holding that rank
+    auto pct = [&](double p) -> uint64_t
+    {
+        uint64_t rank = (uint64_t)(p * n), seen = 0;
+        for (int i = 0; i < 65; i++)
+            if ((seen += b[i]) > rank)
+                return i ? (i == 64 ? ~0ULL : (1ULL << i) - 1) : 0;
+        return maxValue.load(memory_order_relaxed);
+    };
+    out << name << ": " << n << " samples, mean " << (double)sum.load(memory_order_relaxed) / n << ", p50 <= " << pct(0.5)
+        << ", p99 <= " << pct(0.99) << ", max " << maxValue.load(memory_order_relaxed) << "\n";
+    int lo = 0, hi = 64;
+    while (!b[lo])
+        lo++;
+    while (!b[hi])
+        hi--;
+    for (int i = lo; i <= hi; i++)
+    {
+        uint64_t from = i ? 1ULL << (i - 1) : 0;
+        out << "  [" << setw(10) << from << ", " << setw(10) << (i ? 1ULL << i : 1) << ") " << setw(10) << b[i] << " "
+            << string((size_t)(40 * b[i] / peak), '#') << "\n";
+    }
+}
+
+void SetHeatmap::print(ostream &out, const string &name) const
+{
+    if (misses.empty())
+        return;
+    static const char SHADES[] = " .:-=+*#%@";
+    size_t cells = min<size_t>(64, misses.size());
+    size_t per = (misses.size() + cells - 1) / cells;
+    vector<uint64_t> cell(cells, 0);
+    uint64_t peak = 0;
+    for (size_t s = 0; s < misses.size(); s++)
+        peak = max(peak, cell[s / per] += misses[s]);
+    out << name << " misses per set (" << misses.size() << " sets, " << per << " per cell): |";
+    for (uint64_t c : cell)
+        out << (peak ? SHADES[c ? 1 + 8 * c / peak : 0] : ' ');
+    out << "|\n";
+    vector<size_t> hottest(misses.size());
+    for (size_t s = 0; s < hottest.size(); s++)
+        hottest[s] = s;
+    size_t top = min<size_t>(5, hottest.size());
+    partial_sort(hottest.begin(), hottest.begin() + top, hottest.end(), [&](size_t a, size_t b)
+                 { return misses[a] > misses[b]; });
+    out << name << " hottest sets:";
+    for (size_t i = 0; i < top && misses[hottest[i]]; i++)
+        out << " " << hottest[i] << " (" << misses[hottest[i]] << ")";
+    out << "\n";
+}
+
+bool instrumentEnabled()
+{
+    return true;
+}
+
+void instrumentReport(ostream &out)
+{
+    out << "Counters:\n";
+    for (int i = 0; i < INSTR_COUNTERS; i++)
+        out << "  " << COUNTER_NAMES[i] << ": " << instrCounters[i].load(memory_order_relaxed) << "\n";
+    for (int i = 0; i < INSTR_HISTOGRAMS; i++)
+        instrHistograms[i].print(out, HISTOGRAM_NAMES[i]);
+    uint64_t events = ringHead.load(memory_order_relaxed);
+    out << "Trace events: " << min<uint64_t>(events, RING_SIZE) << " buffered of " << events << " recorded\n";
+}
+
+void instrumentReset()
+{
+    for (atomic<uint64_t> &c : instrCounters)
+        c.store(0, memory_order_relaxed);
+    for (LogHistogram &h : instrHistograms)
+        h.reset();
+    // Slots keep their old sequence numbers, which the exporter rejects
+    ringHead.store(0, memory_order_relaxed);
+    for (EventSlot &e : ring)
+        e.seq.store(0, memory_order_relaxed);
+}
+
+bool exportChromeTrace(const string &path)
+{
+    ofstream out(path);
+    if (!out)
+        return false;
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+    uint64_t head = ringHead.load(memory_order_acquire);
+    uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+    bool any = false;
+    out << fixed << setprecision(3);
+    for (uint64_t i = first; i < head; i++)
+    {
+        EventSlot &e = ring[i & (RING_SIZE - 1)];
+        if (e.seq.load(memory_order_acquire) != 2 * i + 2)
+            continue;
+        const char *name = e.name.load(memory_order_relaxed);
+        const char *cat = e.cat.load(memory_order_relaxed);
+        const char *argName = e.argName.load(memory_order_relaxed);
+        uint64_t start = e.start.load(memory_order_relaxed);
+        uint64_t dur = e.dur.load(memory_order_relaxed);
+        uint64_t arg = e.arg.load(memory_order_relaxed);
+        uint32_t tid = e.tid.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (e.seq.load(memory_order_relaxed) != 2 * i + 2)
+            continue;
+        // Chrome trace times are microseconds
+        out << (any ? ",\n" : "") << "{\"name\": \"" << name << "\", \"cat\": \"" << cat << "\", \"ph\": \"X\", \"ts\": "
+            << start / 1000.0 << ", \"dur\": " << dur / 1000.0 << ", \"pid\": 1, \"tid\": " << tid
+            << ", \"args\": {\"" << argName << "\": " << arg << "}}";
+        any = true;
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
+
+#else
+
+bool instrumentEnabled()
+{
+    return false;
+}
+
+void instrumentReport(ostream &out)
+{
+    out << "Instrumentation is compiled out; rebuild with make INSTRUMENT=1\n";
+}
+
+void instrumentReset()
+{
+}
+
+bool exportChromeTrace(const string &)
+{
+    return false;
+}
+
+#endif
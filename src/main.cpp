@@ -3,144 +3,371 @@
 #include <sstream>
 #include "../include/Cache.h"
 #include "../include/MultilevelCache.h"
+#include "../include/Coherence.h"
+#include "../include/StackDistance.h"
 #include "../include/Buddy.h"
+#include "../include/SlabAllocator.h"
+#include "../include/Trace.h"
+#include "../include/VirtualMemory.h"
+#include "../include/PageReplacement.h"
+#include "../include/Simulator.h"
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <climits>
+#include <unordered_map>
 using namespace std;
 
-void printHelp()
+void printUsage()
 {
-    cout << "\nAvailable commands:\n";
-    cout << " malloc <size> <first|best|worst>\n";
-    cout << " free <address>\n";
-    cout << " dump\n";
-    cout << " stats\n";
-    cout << " CacheAccess <address>\n";
-    cout << " Cachestats\n";
-    cout << " BuddyAlloc <size>\n";
-    cout << " BuddyFree <address>\n";
-    cout << " help\n";
-    cout << " exit \n";
+    cout << "Usage:\n";
+    cout << " out [--cache-config <file>]           interactive simulator\n";
+    cout << " out [--cache-config <file>] --replay <trace>\n";
+    cout << "                                       replay a trace through the cache hierarchy\n";
+    cout << " out [--cache-config <file>] --coherence <trace> <cores> [threads]\n";
+    cout << "                                       replay a per-core trace on private caches kept\n";
+    cout << "                                       coherent with MESI (last level shared)\n";
+    cout << " out --compare-policies <trace> <size> <blockSize> <assoc> [threads]\n";
+    cout << "                                       one cache per policy, sets sharded over threads\n";
+    cout << " out --sweep <trace> <minSize> <maxSize> [blockSizes] [maxAssoc]\n";
+    cout << "                                       LRU miss-ratio curves for every power-of-two size,\n";
+    cout << "                                       block size (comma list, default 64) and\n";
+    cout << "                                       associativity up to maxAssoc (default 16), one pass\n";
+    cout << " out [--cache-config <file>] --vm-replay <trace> <frames> [never|always|promote[:N]] [1g]\n";
+    cout << "                                       translate a per-process trace (core = pid) through\n";
+    cout << "                                       TLBs and demand-paged page tables, then the cache\n";
+    cout << "                                       hierarchy; optional 2 MiB THP mode and 1 GiB pages\n";
+    cout << " out --paging <trace> <minFrames> [maxFrames] [window] [threads]\n";
+    cout << "                                       page fault curves of FIFO, LRU, Clock, Clock-Pro,\n";
+    cout << "                                       ARC and OPT for power-of-two frame counts, and the\n";
+    cout << "                                       working set over window references (default 10000)\n";
+    cout << " out --convert <in> <out> <text|raw|varint>\n";
+    cout << " out [--cache-config <file>] --batch <commands> [--quiet]\n";
+    cout << "                                       run a file of REPL commands without prompts; output\n";
+    cout << "                                       is buffered, or suppressed with --quiet\n";
 }
 
-int main()
+// Replays a multi-core trace through per-core private caches and a shared LLC
+bool replayCoherent(const HierarchyConfig &cfg, const string &path, int cores, int threads)
 {
-    PhysicalMemory pm(256);
-    Cache l1(4, 4, 1);
-    Cache l2(16, 4, 1);
-    MultilevelCache Mc(l1, l2);
-    Buddy ba(512);
-    cout << "Memory management Simulator\n";
-    string line;
-    while (true)
+    string err;
+    if (!checkCoherenceConfig(cfg, cores, err))
     {
-        cout << "mem> ";
-        getline(cin, line);
-        if (line.empty())
-            continue;
-        stringstream ss(line);
-        string cmd;
-        ss >> cmd;
-        if (cmd == "malloc")
+        cout << "Bad coherence setup: " << err << '\n';
+        return false;
+    }
+    TraceReader trace(path);
+    if (!trace.good())
+    {
+        cout << "Could not open trace " << path << '\n';
+        return false;
+    }
+    CoherentSystem sys(cfg, cores);
+    auto start = chrono::steady_clock::now();
+    long long n = sys.replay(trace, threads);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Replayed " << n << " accesses in " << secs << " s";
+    if (secs > 0)
+        cout << " (" << n / secs / 1e6 << " M accesses/s)";
+    cout << '\n';
+    if (trace.skippedLines())
+        cout << "Skipped " << trace.skippedLines() << " malformed lines\n";
+    sys.stats();
+    return true;
+}
+
+// Parses never, always or promote[:threshold]
+bool parseThp(const string &s, ThpMode &mode, int &threshold)
+{
+    threshold = PT_ENTRIES;
+    if (s == "never")
+        mode = THP_NEVER;
+    else if (s == "always")
+        mode = THP_ALWAYS;
+    else if (s.compare(0, 7, "promote") == 0)
+    {
+        mode = THP_PROMOTE;
+        if (s.size() > 7)
         {
-            int size;
-            string strat;
-            ss >> size >> strat;
-            if (ss.fail())
-            {
-                cout << "Usage: malloc <size> <first|best|worst>\n";
-                continue;
-            }
-            int add = -1;
-            if (strat == "first")
-                add = pm.allocateFirstFit(size);
-            else if (strat == "best")
-                add = pm.allocateBestFit(size);
-            else if (strat == "worst")
-                add = pm.allocateWorstFit(size);
-            else
-            {
-                cout << "Unknown strategy\n";
-                continue;
-            }
-            if (add == -1)
-                cout << "Allocation failed\n";
-            else
-                cout << "Allocated " << size << " bytes at address " << add << "\n";
+            if (s[7] != ':')
+                return false;
+            threshold = atoi(s.c_str() + 8);
+            if (threshold < 1 || threshold > PT_ENTRIES)
+                return false;
         }
-        else if (cmd == "free")
+    }
+    else
+        return false;
+    return true;
+}
+
+// Translates a per-process trace through TLBs and page tables backed by
+// frames physical frames and runs the physical addresses through the hierarchy
+bool replayVirtual(MultilevelCache &Mc, const string &path, int frames, ThpMode thp, int threshold, bool giant)
+{
+    if (frames <= 0)
+    {
+        cout << "Frame count must be positive\n";
+        return false;
+    }
+    TraceReader trace(path);
+    if (!trace.good())
+    {
+        cout << "Could not open trace " << path << '\n';
+        return false;
+    }
+    VirtualMemory vm(frames);
+    Tlb tlb(defaultTlbConfig());
+    vm.setHugePages(thp, giant, threshold);
+    vm.attachTlb(&tlb);
+    auto start = chrono::steady_clock::now();
+    long long n = vm.replay(trace, &Mc);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Replayed " << n << " accesses in " << secs << " s";
+    if (n > 0)
+        cout << " (" << secs * 1e9 / n << " ns/access)";
+    cout << '\n';
+    if (trace.skippedLines())
+        cout << "Skipped " << trace.skippedLines() << " malformed lines\n";
+    vm.stats();
+    Mc.cacheStats();
+    return true;
+}
+
+int runCommandLine(const vector<string> &args, const HierarchyConfig &cfg, Simulator &sim)
+{
+    MultilevelCache &Mc = sim.Mc;
+    const string &mode = args[0];
+    size_t n = args.size();
+    if (mode == "--batch" && (n == 2 || (n == 3 && args[2] == "--quiet")))
+    {
+        return runBatch(sim, args[1], n == 3) ? 0 : 1;
+    }
+    if (mode == "--replay" && n == 2)
+    {
+        return replayTrace(Mc, args[1]) ? 0 : 1;
+    }
+    if (mode == "--coherence" && (n == 3 || n == 4))
+    {
+        int threads = n == 4 ? atoi(args[3].c_str()) : (int)thread::hardware_concurrency();
+        return replayCoherent(cfg, args[1], atoi(args[2].c_str()), threads) ? 0 : 1;
+    }
+    if (mode == "--compare-policies" && (n == 5 || n == 6))
+    {
+        long long size = atoll(args[2].c_str());
+        int blockSize = atoi(args[3].c_str()), assoc = atoi(args[4].c_str());
+        int threads = n == 6 ? atoi(args[5].c_str()) : 1;
+        // The same shape rules as a --cache-config level, plus a power-of-two
+        // block size as for --sweep
+        bool pow2Block = blockSize > 0 && (blockSize & (blockSize - 1)) == 0;
+        if (!pow2Block || assoc < 1 || assoc > 64 || size < (long long)blockSize * assoc || size > INT_MAX || threads < 1)
         {
-            int add;
-            ss >> add;
-            if (ss.fail())
-            {
-                cout << "Usage: free <address>\n";
-                continue;
-            }
-            pm.freeMem(add);
-            cout << "Freed Memory at address " << add << '\n';
+            cout << "blockSize must be a power of two, assoc 1-64, blockSize*assoc <= size < 2^31 and threads >= 1\n";
+            return 1;
         }
-        else if (cmd == "dump")
+        TraceReader trace(args[1]);
+        if (!trace.good())
         {
-            pm.dump();
+            cout << "Could not open trace " << args[1] << '\n';
+            return 1;
         }
-        else if (cmd == "stats")
+        // OPT needs the whole trace up front for its next-use index
+        vector<unsigned long long> addrs;
+        TraceRecord recs[4096];
+        size_t got;
+        while ((got = trace.read(recs, 4096)) > 0)
+            for (size_t i = 0; i < got; i++)
+                addrs.push_back(recs[i].addr);
+        comparePolicies(addrs, (int)size, blockSize, assoc, threads);
+        return 0;
+    }
+    if (mode == "--sweep" && n >= 4 && n <= 6)
+    {
+        long long minSize = atoll(args[2].c_str()), maxSize = atoll(args[3].c_str());
+        int maxAssoc = n == 6 ? atoi(args[5].c_str()) : 16;
+        vector<int> blockSizes;
+        stringstream bs(n >= 5 ? args[4] : string("64"));
+        string tok;
+        while (getline(bs, tok, ','))
+            blockSizes.push_back(atoi(tok.c_str()));
+        auto pow2 = [](long long v) { return v > 0 && (v & (v - 1)) == 0; };
+        bool ok = pow2(minSize) && pow2(maxSize) && minSize <= maxSize && pow2(maxAssoc) && !blockSizes.empty();
+        for (int b : blockSizes)
+            ok = ok && pow2(b) && maxSize / b < (1LL << 30);
+        if (!ok)
         {
-            pm.stats();
+            cout << "Sizes, block sizes and maxAssoc must be powers of two with minSize <= maxSize < 2^30 blocks\n";
+            return 1;
         }
-        else if (cmd == "CacheAccess")
+        TraceReader trace(args[1]);
+        if (!trace.good())
         {
-            int addr;
-            ss >> addr;
-            if (ss.fail())
-            {
-                cout << "Usage: CacheAccess <address>\n";
-                continue;
-            }
-            Mc.access(addr);
+            cout << "Could not open trace " << args[1] << '\n';
+            return 1;
+        }
+        CacheSweep sweep(blockSizes, minSize, maxSize, maxAssoc);
+        sweep.replay(trace);
+        sweep.printCurves();
+        return 0;
+    }
+    if (mode == "--vm-replay" && n >= 3 && n <= 5)
+    {
+        ThpMode thp = THP_NEVER;
+        int threshold = PT_ENTRIES;
+        if (n >= 4 && !parseThp(args[3], thp, threshold))
+        {
+            cout << "THP mode must be never, always or promote[:1-512]\n";
+            return 1;
         }
-        else if (cmd == "Cachestats")
+        bool giant = n == 5 && args[4] == "1g";
+        if (n == 5 && !giant)
         {
-            Mc.cacheStats();
+            printUsage();
+            return 1;
         }
-        else if (cmd == "BuddyAlloc")
+        return replayVirtual(Mc, args[1], atoi(args[2].c_str()), thp, threshold, giant) ? 0 : 1;
+    }
+    if (mode == "--paging" && n >= 3 && n <= 6)
+    {
+        int minFrames = atoi(args[2].c_str());
+        int maxFrames = n >= 4 ? atoi(args[3].c_str()) : minFrames;
+        long long window = n >= 5 ? atoll(args[4].c_str()) : 10000;
+        int threads = n == 6 ? atoi(args[5].c_str()) : 1;
+        if (minFrames < 1 || maxFrames < minFrames || window < 1)
         {
-            int sz;
-            ss >> sz;
-            if (ss.fail())
+            cout << "Frame counts must satisfy 1 <= minFrames <= maxFrames, and the window must be positive\n";
+            return 1;
+        }
+        TraceReader trace(args[1]);
+        if (!trace.good())
+        {
+            cout << "Could not open trace " << args[1] << '\n';
+            return 1;
+        }
+        // Pages of different processes (the core field) never alias: each
+        // (core, page) pair gets its own number, since a 16-bit core and a
+        // 52-bit page number do not pack into one 64-bit key
+        vector<unsigned long long> pages;
+        unordered_map<unsigned short, unordered_map<unsigned long long, unsigned long long>> pageNumbers;
+        unsigned long long numbered = 0;
+        TraceRecord recs[4096];
+        size_t got;
+        while ((got = trace.read(recs, 4096)) > 0)
+            for (size_t i = 0; i < got; i++)
             {
-                cout << "Usage: BuddyAlloc <size>\n";
-                continue;
+                auto ins = pageNumbers[recs[i].core].emplace(recs[i].addr >> PAGE_SHIFT, numbered);
+                numbered += ins.second;
+                pages.push_back(ins.first->second);
             }
-            void *addr = ba.access(sz);
-            if (!addr)
-                cout << "Buddy allocation failed\n";
-            else
-                cout << "buddy allocated " << sz << " bytes at " << addr << '\n';
+        comparePageReplacement(pages, minFrames, maxFrames, window, threads);
+        return 0;
+    }
+    if (mode == "--convert" && n == 4)
+    {
+        TraceFormat fmt;
+        if (!parseTraceFormat(args[3], fmt))
+        {
+            cout << "Unknown trace format " << args[3] << '\n';
+            return 1;
+        }
+        TraceReader in(args[1]);
+        TraceWriter out(args[2], fmt);
+        if (!in.good() || !out.good())
+        {
+            cout << "Could not open trace files\n";
+            return 1;
         }
-        else if (cmd == "BuddyFree")
+        TraceRecord recs[4096];
+        size_t got;
+        long long total = 0;
+        while ((got = in.read(recs, 4096)) > 0)
         {
-            void *addr;
-            ss >> addr;
-            if (ss.fail())
+            for (size_t i = 0; i < got; i++)
             {
-                cout << "Usage: BuddyFree<address>\n";
-                continue;
+                if (out.write(recs[i]))
+                    continue;
+                if (out.good())
+                    cout << "Access " << total + i + 1 << " (core " << recs[i].core << ", address " << recs[i].addr
+                         << ") does not fit the " << args[3] << " format\n";
+                else
+                    cout << "Could not write " << args[2] << '\n';
+                return 1;
             }
-            ba.free(addr);
-            cout << "Buddy block freed at " << addr << '\n';
+            total += got;
         }
-        else if (cmd == "help")
+        if (!out.close())
         {
-            printHelp();
+            cout << "Could not write " << args[2] << '\n';
+            return 1;
         }
-        else if (cmd == "exit")
+        cout << "Converted " << total << " accesses\n";
+        if (in.skippedLines())
+            cout << "Skipped " << in.skippedLines() << " malformed lines\n";
+        return 0;
+    }
+    printUsage();
+    return 1;
+}
+
+// Options that come before the mode
+struct CommandLine
+{
+    string cacheConfig; // empty for the default hierarchy
+    vector<string> args; // the mode and its arguments; empty for the REPL
+};
+
+// False if an option is missing its value
+bool parseCommandLine(int argc, char **argv, CommandLine &cl)
+{
+    int i = 1;
+    while (i < argc && string(argv[i]) == "--cache-config")
+    {
+        if (i + 1 == argc)
+            return false;
+        cl.cacheConfig = argv[i + 1];
+        i += 2;
+    }
+    cl.args.assign(argv + i, argv + argc);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    CommandLine cl;
+    if (!parseCommandLine(argc, argv, cl))
+    {
+        printUsage();
+        return 1;
+    }
+    HierarchyConfig cacheCfg = defaultHierarchyConfig();
+    if (!cl.cacheConfig.empty())
+    {
+        string err;
+        if (!loadHierarchyConfig(cl.cacheConfig, cacheCfg, err))
         {
-            cout << "Exiting simulator.\n";
-            break;
+            cout << "Bad cache config: " << err << '\n';
+            return 1;
         }
-        else
+    }
+    Simulator sim(cacheCfg);
+    if (!cl.args.empty())
+        return runCommandLine(cl.args, cacheCfg, sim);
+    cout << "Memory management Simulator\n";
+    string line;
+    CommandArgs args;
+    while (true)
+    {
+        cout << "mem> ";
+        if (!getline(cin, line))
         {
-            cout << "Unknown command.Type 'help for commands.\n";
+            cout << '\n';
+            break;
         }
+        splitCommand(line.data(), line.data() + line.size(), args);
+        if (args.count == 0)
+            continue;
+        if (sim.execute(args) == CMD_EXIT)
+            break;
     }
     return 0;
 }
@@ -0,0 +1,392 @@
+#include "../../include/Simulator.h"
+#include "../../include/Trace.h"
+#include "../../include/Instrumentation.h"
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+#include <unistd.h>
+using namespace std;
+
+
+bool replayTrace(MultilevelCache &Mc, const string &path)
+{
+    TraceReader trace(path);
+    if (!trace.good())
+    {
+        cout << "Could not open trace " << path << '\n';
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    long long n = Mc.replay(trace);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Replayed " << n << " accesses in " << secs << " s";
+    if (secs > 0)
+        cout << " (" << n / secs / 1e6 << " M accesses/s)";
+    cout << '\n';
+    if (trace.skippedLines())
+        cout << "Skipped " << trace.skippedLines() << " malformed lines\n";
+    Mc.cacheStats();
+    return true;
+}
+
+// Handler of one command; prints its output to cout
+typedef CommandResult (*CommandFn)(Simulator &, const CommandArgs &);
+
+struct Command
+{
+    const char *name;
+    const char *usage;
+    int minArgs;
+    CommandFn run;
+};
+
+// Optional argument i, or def when it is absent
+template <class T>
+static bool optionalArg(const CommandArgs &a, int i, T &v, T def)
+{
+    v = def;
+    return a.count <= i || parseArg(a.word[i], v);
+}
+
+static CommandResult cmdMalloc(Simulator &s, const CommandArgs &a)
+{
+    int size;
+    if (!parseArg(a.word[1], size))
+        return CMD_USAGE;
+    string_view strat = a.word[2];
+    int add = -1;
+    if (strat == "first")
+        add = s.pm.allocateFirstFit(size);
+    else if (strat == "best")
+        add = s.pm.allocateBestFit(size);
+    else if (strat == "worst")
+        add = s.pm.allocateWorstFit(size);
+    else if (strat == "tlsf")
+        add = s.pm.allocateTlsf(size);
+    else
+    {
+        cout << "Unknown strategy\n";
+        return CMD_OK;
+    }
+    if (add == -1)
+        cout << "Allocation failed\n";
+    else
+        cout << "Allocated " << size << " bytes at address " << add << '\n';
+    return CMD_OK;
+}
+
+static CommandResult cmdFree(Simulator &s, const CommandArgs &a)
+{
+    int add;
+    if (!parseArg(a.word[1], add))
+        return CMD_USAGE;
+    FreeResult res = s.pm.freeMem(add);
+    if (res == FREE_INVALID)
+        cout << "Invalid free at address " << add << '\n';
+    else if (res == FREE_DOUBLE)
+        cout << "Double free at address " << add << '\n';
+    else
+        cout << "Freed Memory at address " << add << '\n';
+    return CMD_OK;
+}
+
+static CommandResult cmdDump(Simulator &s, const CommandArgs &)
+{
+    s.pm.dump();
+    return CMD_OK;
+}
+
+static CommandResult cmdStats(Simulator &s, const CommandArgs &)
+{
+    s.pm.stats();
+    return CMD_OK;
+}
+
+static CommandResult cmdCacheAccess(Simulator &s, const CommandArgs &a)
+{
+    unsigned long long addr;
+    if (!parseArg(a.word[1], addr))
+        return CMD_USAGE;
+    s.Mc.access(addr);
+    return CMD_OK;
+}
+
+static CommandResult cmdCacheWrite(Simulator &s, const CommandArgs &a)
+{
+    unsigned long long addr;
+    if (!parseArg(a.word[1], addr))
+        return CMD_USAGE;
+    s.Mc.access(addr, true);
+    return CMD_OK;
+}
+
+static CommandResult cmdCacheStats(Simulator &s, const CommandArgs &)
+{
+    s.Mc.cacheStats();
+    return CMD_OK;
+}
+
+static CommandResult cmdCacheReplay(Simulator &s, const CommandArgs &a)
+{
+    replayTrace(s.Mc, string(a.word[1]));
+    return CMD_OK;
+}
+
+static CommandResult cmdBuddyAlloc(Simulator &s, const CommandArgs &a)
+{
+    int sz;
+    if (!parseArg(a.word[1], sz) || sz <= 0)
+        return CMD_USAGE;
+    long long addr = s.ba.access(sz);
+    if (addr < 0)
+        cout << "Buddy allocation failed\n";
+    else
+        cout << "buddy allocated " << sz << " bytes at " << addr << '\n';
+    return CMD_OK;
+}
+
+static CommandResult cmdBuddyFree(Simulator &s, const CommandArgs &a)
+{
+    unsigned long long addr;
+    if (!parseArg(a.word[1], addr))
+        return CMD_USAGE;
+    if (s.ba.free(addr))
+        cout << "Buddy block freed at " << addr << '\n';
+    else
+        cout << "Invalid buddy free at " << addr << '\n';
+    return CMD_OK;
+}
+
+static CommandResult cmdSlabAlloc(Simulator &s, const CommandArgs &a)
+{
+    unsigned long long sz;
+    int cpu;
+    if (!parseArg(a.word[1], sz) || !optionalArg(a, 2, cpu, 0))
+        return CMD_USAGE;
+    if (cpu < 0 || cpu >= s.slab.cpuCount())
+    {
+        cout << "Invalid cpu " << cpu << '\n';
+        return CMD_OK;
+    }
+    long long addr = s.slab.alloc(cpu, sz);
+    if (addr < 0)
+        cout << "Slab allocation failed\n";
+    else
+        cout << "slab allocated " << sz << " bytes at " << addr << '\n';
+    return CMD_OK;
+}
+
+static CommandResult cmdSlabFree(Simulator &s, const CommandArgs &a)
+{
+    unsigned long long addr;
+    int cpu;
+    if (!parseArg(a.word[1], addr) || !optionalArg(a, 2, cpu, 0))
+        return CMD_USAGE;
+    if (cpu < 0 || cpu >= s.slab.cpuCount())
+    {
+        cout << "Invalid cpu " << cpu << '\n';
+        return CMD_OK;
+    }
+    if (s.slab.free(cpu, addr))
+        cout << "Slab object freed at " << addr << '\n';
+    else
+        cout << "Invalid slab free at " << addr << '\n';
+    return CMD_OK;
+}
+
+static CommandResult cmdSlabReclaim(Simulator &s, const CommandArgs &)
+{
+    for (int cpu = 0; cpu < s.slab.cpuCount(); cpu++)
+        s.slab.drain(cpu);
+    cout << "Reclaimed " << s.slab.reclaim() << " bytes\n";
+    return CMD_OK;
+}
+
+static CommandResult cmdSlabStats(Simulator &s, const CommandArgs &)
+{
+    s.slab.stats();
+    return CMD_OK;
+}
+
+static CommandResult cmdVAccess(Simulator &s, const CommandArgs &a)
+{
+    int pid;
+    unsigned long long vaddr;
+    if (!parseArg(a.word[1], pid) || pid < 0 || !parseArg(a.word[2], vaddr))
+        return CMD_USAGE;
+    s.vm.access(pid, vaddr, a.count > 3 && a.word[3] == "w");
+    return CMD_OK;
+}
+
+static CommandResult cmdVFree(Simulator &s, const CommandArgs &a)
+{
+    int pid;
+    if (!parseArg(a.word[1], pid) || pid < 0)
+        return CMD_USAGE;
+    if (s.vm.destroyProcess(pid))
+        cout << "Freed address space of process " << pid << '\n';
+    else
+        cout << "No process " << pid << '\n';
+    return CMD_OK;
+}
+
+static CommandResult cmdVMStats(Simulator &s, const CommandArgs &)
+{
+    s.vm.stats();
+    return CMD_OK;
+}
+
+static CommandResult cmdInstrument(Simulator &s, const CommandArgs &)
+{
+    instrumentReport(cout);
+#ifdef MEMSIM_INSTRUMENT
+    s.Mc.missHeatmaps();
+#endif
+    return CMD_OK;
+}
+
+static CommandResult cmdInstrumentReset(Simulator &, const CommandArgs &)
+{
+    instrumentReset();
+    cout << (instrumentEnabled() ? "Instrumentation reset\n" : "Instrumentation is compiled out\n");
+    return CMD_OK;
+}
+
+static CommandResult cmdTraceExport(Simulator &, const CommandArgs &a)
+{
+    string path(a.word[1]);
+    if (!instrumentEnabled())
+        cout << "Instrumentation is compiled out; rebuild with make INSTRUMENT=1\n";
+    else if (exportChromeTrace(path))
+        cout << "Trace written to " << path << '\n';
+    else
+        cout << "Cannot write " << path << '\n';
+    return CMD_OK;
+}
+
+static CommandResult cmdHelp(Simulator &, const CommandArgs &)
+{
+    printHelp();
+    return CMD_OK;
+}
+
+static CommandResult cmdExit(Simulator &, const CommandArgs &)
+{
+    cout << "Exiting simulator.\n";
+    return CMD_EXIT;
+}
+
+// Every command of the REPL and of --batch files, in help order
+static const Command COMMANDS[] = {
+    {"malloc", "malloc <size> <first|best|worst|tlsf>", 2, cmdMalloc},
+    {"free", "free <address>", 1, cmdFree},
+    {"dump", "dump", 0, cmdDump},
+    {"stats", "stats", 0, cmdStats},
+    {"CacheAccess", "CacheAccess <address>", 1, cmdCacheAccess},
+    {"CacheWrite", "CacheWrite <address>", 1, cmdCacheWrite},
+    {"Cachestats", "Cachestats", 0, cmdCacheStats},
+    {"CacheReplay", "CacheReplay <trace file>", 1, cmdCacheReplay},
+    {"BuddyAlloc", "BuddyAlloc <size>", 1, cmdBuddyAlloc},
+    {"BuddyFree", "BuddyFree <address>", 1, cmdBuddyFree},
+    {"SlabAlloc", "SlabAlloc <size> [cpu]", 1, cmdSlabAlloc},
+    {"SlabFree", "SlabFree <address> [cpu]", 1, cmdSlabFree},
+    {"SlabReclaim", "SlabReclaim", 0, cmdSlabReclaim},
+    {"SlabStats", "SlabStats", 0, cmdSlabStats},
+    {"VAccess", "VAccess <pid> <virtual address> [r|w]", 2, cmdVAccess},
+    {"VFree", "VFree <pid>", 1, cmdVFree},
+    {"VMstats", "VMstats", 0, cmdVMStats},
+    {"Instrument", "Instrument", 0, cmdInstrument},
+    {"InstrumentReset", "InstrumentReset", 0, cmdInstrumentReset},
+    {"TraceExport", "TraceExport <file>", 1, cmdTraceExport},
+    {"help", "help", 0, cmdHelp},
+    {"exit", "exit", 0, cmdExit},
+};
+
+void printHelp()
+{
+    cout << "\nAvailable commands:\n";
+    for (const Command &c : COMMANDS)
+        cout << ' ' << c.usage << '\n';
+}
+
+Simulator::Simulator(const HierarchyConfig &cfg)
+    : pm(256), Mc(cfg), ba(512), slab(1 << 16, 2), vm(64), tlb(defaultTlbConfig())
+{
+    vm.attachTlb(&tlb);
+    unknownCommands = 0;
+}
+
+// The command word is looked up in a hash table built once from COMMANDS
+CommandResult Simulator::execute(const CommandArgs &a)
+{
+    static const unordered_map<string_view, const Command *> table = []
+    {
+        unordered_map<string_view, const Command *> t;
+        for (const Command &c : COMMANDS)
+            t[c.name] = &c;
+        return t;
+    }();
+    auto it = table.find(a.word[0]);
+    if (it == table.end())
+    {
+        unknownCommands++;
+        cout << "Unknown command.Type 'help for commands.\n";
+        return CMD_OK;
+    }
+    const Command &c = *it->second;
+    CommandResult res = a.count > c.minArgs ? c.run(*this, a) : CMD_USAGE;
+    if (res == CMD_USAGE)
+        cout << "Usage: " << c.usage << '\n';
+    return res;
+}
+
+CommandResult Simulator::execute(const string &line)
+{
+    CommandArgs args;
+    splitCommand(line.data(), line.data() + line.size(), args);
+    return args.count ? execute(args) : CMD_OK;
+}
+
+bool runBatch(Simulator &s, const string &path, bool quiet)
+{
+    MappedFile file(path);
+    if (!file.good())
+    {
+        cout << "Could not open batch file " << path << '\n';
+        return false;
+    }
+    long long commands = 0, unknown = s.unknownCommands;
+    auto start = chrono::steady_clock::now();
+    {
+        OutputBuffer out(STDOUT_FILENO);
+        streambuf *console = cout.rdbuf(&out);
+        // A stream in a failed state skips formatting altogether
+        if (quiet)
+            cout.setstate(ios::badbit);
+        CommandArgs args;
+        for (const char *p = file.begin(), *end = file.end(); p < end;)
+        {
+            const char *nl = (const char *)memchr(p, '\n', end - p);
+            const char *eol = nl ? nl : end;
+            splitCommand(p, eol, args);
+            p = eol + 1;
+            if (args.count == 0 || args.word[0][0] == '#')
+                continue;
+            commands++;
+            if (s.execute(args) == CMD_EXIT)
+                break;
+        }
+        cout.clear();
+        cout.flush();
+        cout.rdbuf(console);
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "Ran " << commands << " commands in " << secs << " s";
+    if (secs > 0)
+        cerr << " (" << commands / secs / 1e6 << " M commands/s)";
+    cerr << '\n';
+    if (s.unknownCommands > unknown)
+        cerr << s.unknownCommands - unknown << " unknown commands\n";
+    return true;
+}
@@ -0,0 +1,433 @@
+#include "../../include/SlabAllocator.h"
+#include "../../include/Instrumentation.h"
+#include <iostream>
+#include <algorithm>
+using namespace std;
+
+// kmalloc-style classes: powers of two plus 48/96/192/384/768/1536 to halve
+// the worst-case rounding between them
+static const int CLASS_SIZES[] = {8, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048};
+static const int CLASS_COUNT = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+// Slabs are sized to hold at least this many objects
+static const int MIN_OBJS = 8;
+
+SlabAllocator::SlabAllocator(u64 arenaBytes, int cpuCount, int magazineSize)
+    : area(arenaBytes, 12), cpus(cpuCount)
+{
+    this->arenaBytes = 1ULL << area.maxOrder();
+    objState = vector<atomic<unsigned char>>(this->arenaBytes / GRANULE);
+    this->magazineSize = magazineSize;
+    failures = 0;
+    for (int c = 0; c < CLASS_COUNT; c++)
+    {
+        SizeClass sc;
+        sc.objSize = CLASS_SIZES[c];
+        sc.slabBytes = PAGE;
+        while (sc.slabBytes < (u64)sc.objSize * MIN_OBJS)
+            sc.slabBytes <<= 1;
+        sc.objsPerSlab = sc.slabBytes / sc.objSize;
+        for (int l = 0; l < SLAB_LISTS; l++)
+        {
+            sc.head[l] = -1;
+            sc.count[l] = 0;
+        }
+        sc.grows = 0;
+        sc.shrinks = 0;
+        classes.push_back(sc);
+    }
+    u64 pages = this->arenaBytes / PAGE;
+    slabs.resize(pages);
+    pageOwner.assign(pages, -1);
+    for (u64 i = pages; i-- > 0;)
+        freeSlots.push_back(i);
+    for (auto &c : cpus)
+    {
+        c.loaded.resize(CLASS_COUNT);
+        c.previous.resize(CLASS_COUNT);
+    }
+}
+
+// What a byte-granular Buddy would hand out for sz
+static unsigned long long pow2(unsigned long long sz)
+{
+    unsigned long long p = 1;
+    while (p < sz)
+        p <<= 1;
+    return p;
+}
+
+int SlabAllocator::classOf(u64 sz) const
+{
+    for (int c = 0; c < CLASS_COUNT; c++)
+    {
+        if (sz <= (u64)CLASS_SIZES[c])
+            return c;
+    }
+    return -1;
+}
+
+void SlabAllocator::link(int cls, int s, int list)
+{
+    SizeClass &sc = classes[cls];
+    Slab &sl = slabs[s];
+    sl.list = list;
+    sl.prev = -1;
+    sl.next = sc.head[list];
+    if (sl.next >= 0)
+        slabs[sl.next].prev = s;
+    sc.head[list] = s;
+    sc.count[list]++;
+}
+
+void SlabAllocator::unlink(int cls, int s)
+{
+    SizeClass &sc = classes[cls];
+    Slab &sl = slabs[s];
+    if (sl.prev >= 0)
+        slabs[sl.prev].next = sl.next;
+    else
+        sc.head[sl.list] = sl.next;
+    if (sl.next >= 0)
+        slabs[sl.next].prev = sl.prev;
+    sc.count[sl.list]--;
+}
+
+// New empty slab for cls from Buddy; -1 if Buddy is out of blocks
+int SlabAllocator::grow(int cls)
+{
+    SizeClass &sc = classes[cls];
+    long long base = area.access(sc.slabBytes);
+    if (base < 0)
+        return -1;
+    int s = freeSlots.back();
+    freeSlots.pop_back();
+    Slab &sl = slabs[s];
+    sl.base = base;
+    sl.cls = cls;
+    sl.inuse = 0;
+    sl.freeHead = 0;
+    sl.nextFree.resize(sc.objsPerSlab);
+    for (int i = 0; i < sc.objsPerSlab; i++)
+        sl.nextFree[i] = i + 1 < sc.objsPerSlab ? i + 1 : -1;
+    sl.requested.assign(sc.objsPerSlab, 0);
+    for (u64 p = base / PAGE; p < (base + sc.slabBytes) / PAGE; p++)
+        pageOwner[p] = s;
+    link(cls, s, SLAB_EMPTY);
+    sc.grows++;
+    return s;
+}
+
+void SlabAllocator::releaseSlab(int s)
+{
+    Slab &sl = slabs[s];
+    SizeClass &sc = classes[sl.cls];
+    unlink(sl.cls, s);
+    for (u64 p = sl.base / PAGE; p < (sl.base + sc.slabBytes) / PAGE; p++)
+        pageOwner[p] = -1;
+    area.free(sl.base);
+    sc.shrinks++;
+    freeSlots.push_back(s);
+}
+
+// One free object of cls off a partial (or else empty, or else new) slab,
+// marked cached; -1 if Buddy has no room. Caller holds the lock.
+long long SlabAllocator::takeObject(int cls)
+{
+    SizeClass &sc = classes[cls];
+    int s = sc.head[SLAB_PARTIAL];
+    if (s < 0)
+        s = sc.head[SLAB_EMPTY];
+    if (s < 0)
+        s = grow(cls);
+    if (s < 0)
+        return -1;
+    Slab &sl = slabs[s];
+    int idx = sl.freeHead;
+    sl.freeHead = sl.nextFree[idx];
+    u64 off = sl.base + (u64)idx * sc.objSize;
+    stateOf(off).store(OBJ_CACHED, memory_order_relaxed);
+    sl.inuse++;
+    int list = sl.inuse == sc.objsPerSlab ? SLAB_FULL : SLAB_PARTIAL;
+    if (list != sl.list)
+    {
+        unlink(cls, s);
+        link(cls, s, list);
+    }
+    return off;
+}
+
+// Returns an object to its slab; caller holds the lock
+void SlabAllocator::putObject(int s, int idx)
+{
+    Slab &sl = slabs[s];
+    SizeClass &sc = classes[sl.cls];
+    stateOf(sl.base + (u64)idx * sc.objSize).store(OBJ_FREE, memory_order_relaxed);
+    sl.nextFree[idx] = sl.freeHead;
+    sl.freeHead = idx;
+    sl.inuse--;
+    int list = sl.inuse == 0 ? SLAB_EMPTY : SLAB_PARTIAL;
+    if (list != sl.list)
+    {
+        unlink(sl.cls, s);
+        // Keep one empty slab per class for the next grow; give the rest back
+        if (list == SLAB_EMPTY && sc.count[SLAB_EMPTY] >= 1)
+        {
+            link(sl.cls, s, list);
+            releaseSlab(s);
+            return;
+        }
+        link(sl.cls, s, list);
+    }
+}
+
+void SlabAllocator::flushMagazine(vector<u64> &mag)
+{
+    int s, idx;
+    for (u64 off : mag)
+    {
+        if (locate(off, s, idx))
+            putObject(s, idx);
+    }
+    mag.clear();
+}
+
+// Slab and index of the object at off. Slabs change under the lock, so the
+// caller holds it or owns the object (which keeps its slab alive).
+bool SlabAllocator::locate(u64 off, int &s, int &idx) const
+{
+    if (off >= arenaBytes)
+        return false;
+    s = pageOwner[off / PAGE];
+    if (s < 0)
+        return false;
+    const Slab &sl = slabs[s];
+    u64 rel = off - sl.base;
+    int size = classes[sl.cls].objSize;
+    if (rel % size)
+        return false;
+    idx = rel / size;
+    return idx < classes[sl.cls].objsPerSlab;
+}
+
+long long SlabAllocator::alloc(int cpu, u64 sz)
+{
+    MEMSIM_SCOPE("slab.alloc", "alloc", SLAB_ALLOC_NS, "bytes", sz);
+    MEMSIM_COUNT(SLAB_ALLOC);
+    MEMSIM_HIST(SLAB_ALLOC_BYTES, sz);
+    if (sz == 0)
+        return -1;
+    int cls = classOf(sz);
+    if (cls < 0)
+    {
+        lock_guard<mutex> g(lock);
+        long long off = area.access(sz);
+        if (off < 0)
+        {
+            failures++;
+            MEMSIM_COUNT(SLAB_ALLOC_FAIL);
+        }
+        else
+            large[off] = sz;
+        return off;
+    }
+    CpuMagazines &c = cpus[cpu];
+    vector<u64> &loaded = c.loaded[cls];
+    if (loaded.empty())
+    {
+        vector<u64> &previous = c.previous[cls];
+        if (!previous.empty())
+        {
+            loaded.swap(previous);
+        }
+        else
+        {
+            // Both magazines empty: take a full one from the depot, or fill
+            // half a magazine straight from the slabs, under one lock
+            lock_guard<mutex> g(lock);
+            c.depotTrips++;
+            SizeClass &sc = classes[cls];
+            if (!sc.depot.empty())
+            {
+                loaded.swap(sc.depot.back());
+                sc.depot.pop_back();
+            }
+            else
+            {
+                for (int i = 0; i < max(1, magazineSize / 2); i++)
+                {
+                    long long off = takeObject(cls);
+                    if (off < 0)
+                        break;
+                    loaded.push_back(off);
+                }
+                // Hand objects out in address order
+                reverse(loaded.begin(), loaded.end());
+            }
+            if (loaded.empty())
+            {
+                failures++;
+                MEMSIM_COUNT(SLAB_ALLOC_FAIL);
+                return -1;
+            }
+        }
+    }
+    u64 off = loaded.back();
+    loaded.pop_back();
+    int s, idx;
+    locate(off, s, idx);
+    slabs[s].requested[idx] = sz;
+    stateOf(off).store(OBJ_ALLOCATED, memory_order_release);
+    c.allocs++;
+    return off;
+}
+
+bool SlabAllocator::free(int cpu, u64 off)
+{
+    MEMSIM_SCOPE("slab.free", "free", SLAB_FREE_NS, "offset", off);
+    // Claim the object before touching its slab, so a concurrent double
+    // free finds it cached and fails
+    unsigned char mark = OBJ_ALLOCATED;
+    if (off >= arenaBytes || off % GRANULE ||
+        !stateOf(off).compare_exchange_strong(mark, OBJ_CACHED, memory_order_acq_rel))
+    {
+        lock_guard<mutex> g(lock);
+        auto it = large.find(off);
+        if (it == large.end())
+            return false;
+        large.erase(it);
+        MEMSIM_COUNT(SLAB_FREE);
+        return area.free(off);
+    }
+    MEMSIM_COUNT(SLAB_FREE);
+    int s, idx;
+    locate(off, s, idx);
+    int cls = slabs[s].cls;
+    CpuMagazines &c = cpus[cpu];
+    c.frees++;
+    vector<u64> &loaded = c.loaded[cls];
+    if ((int)loaded.size() >= magazineSize)
+    {
+        vector<u64> &previous = c.previous[cls];
+        if (previous.empty())
+        {
+            loaded.swap(previous);
+        }
+        else
+        {
+            // Both magazines full: the older one goes to the depot, or back
+            // to the slabs once the depot holds two per CPU
+            lock_guard<mutex> g(lock);
+            c.depotTrips++;
+            SizeClass &sc = classes[cls];
+            if (sc.depot.size() < 2 * cpus.size())
+            {
+                sc.depot.push_back(vector<u64>());
+                sc.depot.back().swap(previous);
+            }
+            else
+            {
+                flushMagazine(previous);
+            }
+            loaded.swap(previous);
+        }
+    }
+    loaded.push_back(off);
+    return true;
+}
+
+void SlabAllocator::drain(int cpu)
+{
+    CpuMagazines &c = cpus[cpu];
+    lock_guard<mutex> g(lock);
+    for (int cls = 0; cls < CLASS_COUNT; cls++)
+    {
+        flushMagazine(c.loaded[cls]);
+        flushMagazine(c.previous[cls]);
+    }
+}
+
+unsigned long long SlabAllocator::reclaim()
+{
+    lock_guard<mutex> g(lock);
+    u64 released = 0;
+    for (int cls = 0; cls < CLASS_COUNT; cls++)
+    {
+        SizeClass &sc = classes[cls];
+        for (auto &mag : sc.depot)
+            flushMagazine(mag);
+        sc.depot.clear();
+        while (sc.head[SLAB_EMPTY] >= 0)
+        {
+            releaseSlab(sc.head[SLAB_EMPTY]);
+            released += sc.slabBytes;
+        }
+    }
+    return released;
+}
+
+void SlabAllocator::stats()
+{
+    lock_guard<mutex> g(lock);
+    cout << "\nSlab Stats:\n";
+    u64 totalSlab = 0, totalReq = 0, totalUsed = 0, buddyWaste = 0;
+    long long totalLive = 0;
+    for (int cls = 0; cls < CLASS_COUNT; cls++)
+    {
+        SizeClass &sc = classes[cls];
+        int nslabs = sc.count[SLAB_EMPTY] + sc.count[SLAB_PARTIAL] + sc.count[SLAB_FULL];
+        if (!nslabs && !sc.grows)
+            continue;
+        long long live = 0, cached = 0;
+        u64 req = 0;
+        for (int l = 0; l < SLAB_LISTS; l++)
+        {
+            for (int s = sc.head[l]; s >= 0; s = slabs[s].next)
+            {
+                const Slab &sl = slabs[s];
+                for (int i = 0; i < sc.objsPerSlab; i++)
+                {
+                    unsigned char state = stateOf(sl.base + (u64)i * sc.objSize).load(memory_order_acquire);
+                    if (state == OBJ_ALLOCATED)
+                    {
+                        live++;
+                        req += sl.requested[i];
+                        buddyWaste += pow2(sl.requested[i]) - sl.requested[i];
+                    }
+                    else if (state == OBJ_CACHED)
+                    {
+                        cached++;
+                    }
+                }
+            }
+        }
+        cout << "size-" << sc.objSize << ": " << nslabs << " slabs (" << sc.count[SLAB_FULL] << " full, " << sc.count[SLAB_PARTIAL]
+             << " partial, " << sc.count[SLAB_EMPTY] << " empty) of " << sc.slabBytes << " bytes, " << live << " objects in use, "
+             << cached << " in magazines, " << sc.grows << " grown, " << sc.shrinks << " returned\n";
+        totalSlab += (u64)nslabs * sc.slabBytes;
+        totalReq += req;
+        totalUsed += (u64)live * sc.objSize;
+        totalLive += live;
+    }
+    for (auto &l : large)
+    {
+        totalReq += l.second;
+        totalUsed += 1ULL << area.getOrd(l.second);
+        buddyWaste += (1ULL << area.getOrd(l.second)) - l.second;
+    }
+    cout << "Large allocations: " << large.size() << '\n';
+    cout << "Slab memory: " << totalSlab << " bytes, " << totalLive << " objects, " << totalReq << " bytes requested\n";
+    cout << "Internal Fragmentation: " << totalUsed - totalReq << " bytes";
+    if (totalUsed)
+        cout << " (" << (double)(totalUsed - totalReq) / totalUsed << ")";
+    cout << ", Buddy alone: " << buddyWaste << " bytes\n";
+    long long allocs = 0, frees = 0, trips = 0;
+    for (auto &c : cpus)
+    {
+        allocs += c.allocs;
+        frees += c.frees;
+        trips += c.depotTrips;
+    }
+    cout << "Magazine operations: " << allocs << " allocs, " << frees << " frees, " << trips << " depot trips\n";
+    if (failures)
+        cout << "Failed allocations: " << failures << '\n';
+}
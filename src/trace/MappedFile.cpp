@@ -0,0 +1,43 @@
+#include "../../include/MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+MappedFile::MappedFile(const string &path)
+{
+    data = nullptr;
+    len = 0;
+    ok = false;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+        len = st.st_size;
+        ok = true;
+        if (len > 0)
+        {
+            void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                ok = false;
+                len = 0;
+            }
+            else
+            {
+                data = (const char *)p;
+                madvise(p, len, MADV_SEQUENTIAL);
+            }
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data)
+        munmap((void *)data, len);
+}
@@ -0,0 +1,267 @@
+#include "../../include/Trace.h"
+#include <cstring>
+#include <climits>
+using namespace std;
+
+static const char RAW_MAGIC[8]={'M','T','R','C','R','A','W','1'};
+static const char VARINT_MAGIC[8]={'M','T','R','C','V','A','R','2'};
+static const char VARINT1_MAGIC[8]={'M','T','R','C','V','A','R','1'};
+static const unsigned long long WRITE_BIT=1ULL<<63;
+static const int CORE_SHIFT=56;
+static const unsigned long long ADDR_MASK=(1ULL<<CORE_SHIFT)-1;
+static const unsigned RAW_MAX_CORE=0x7f;
+
+bool parseTraceFormat(const string& name,TraceFormat& fmt){
+    if(name=="text") fmt=TRACE_TEXT;
+    else if(name=="raw") fmt=TRACE_RAW;
+    else if(name=="varint") fmt=TRACE_VARINT;
+    else return false;
+    return true;
+}
+
+TraceReader::TraceReader(const string& path):file(path){
+    data=file.begin();
+    len=file.size();
+    pos=0;
+    bodyStart=0;
+    fmt=TRACE_TEXT;
+    prev=0;
+    prevCore=0;
+    varintCores=true;
+    badLines=0;
+    if(len>=8 && memcmp(data,RAW_MAGIC,8)==0) fmt=TRACE_RAW;
+    else if(len>=8 && memcmp(data,VARINT_MAGIC,8)==0) fmt=TRACE_VARINT;
+    else if(len>=8 && memcmp(data,VARINT1_MAGIC,8)==0){
+        fmt=TRACE_VARINT;
+        varintCores=false;
+    }
+    bodyStart=fmt==TRACE_TEXT?0:8;
+    pos=bodyStart;
+}
+
+void TraceReader::rewind(){
+    pos=bodyStart;
+    prev=0;
+    prevCore=0;
+    badLines=0;
+}
+
+//A 64-bit value takes at most 10 bytes. Longer or truncated varints are
+//malformed: they are consumed up to their last byte and reported as false.
+static bool readVarint(const char* data,size_t len,size_t& pos,unsigned long long& v){
+    v=0;
+    for(int shift=0;pos<len;shift+=7){
+        unsigned char b=data[pos++];
+        if(shift<64) v|=(unsigned long long)(b&0x7f)<<shift;
+        if(!(b&0x80)) return shift<70;
+    }
+    return false;
+}
+
+static void writeVarint(vector<char>& buf,unsigned long long v){
+    do{
+        unsigned char b=v&0x7f;
+        v>>=7;
+        if(v) b|=0x80;
+        buf.push_back(b);
+    }while(v);
+}
+
+//Parses a decimal or 0x-prefixed hex number at p, advancing p past its
+//digits; false if there are none or the number does not fit 64 bits
+static bool parseNumber(const char*& p,const char* end,unsigned long long& v){
+    v=0;
+    bool overflow=false;
+    const char* start=p;
+    if(end-p>2 && p[0]=='0' && (p[1]=='x' || p[1]=='X')){
+        p+=2;
+        start=p;
+        for(;p<end;p++){
+            char c=*p;
+            int d;
+            if(c>='0' && c<='9') d=c-'0';
+            else if(c>='a' && c<='f') d=c-'a'+10;
+            else if(c>='A' && c<='F') d=c-'A'+10;
+            else break;
+            if(v>>60) overflow=true;
+            v=v<<4|d;
+        }
+    }else{
+        for(;p<end && *p>='0' && *p<='9';p++){
+            int d=*p-'0';
+            if(v>(ULLONG_MAX-d)/10) overflow=true;
+            v=v*10+d;
+        }
+    }
+    return p>start && !overflow;
+}
+
+size_t TraceReader::read(TraceRecord* out,size_t max){
+    size_t n=0;
+    if(fmt==TRACE_RAW){
+        size_t avail=(len-pos)/8;
+        //A partial record at the end is malformed
+        if(avail==0 && pos<len){
+            badLines++;
+            pos=len;
+        }
+        if(avail<max) max=avail;
+        for(;n<max;n++){
+            unsigned long long v;
+            memcpy(&v,data+pos,8);
+            pos+=8;
+            out[n].addr=v&ADDR_MASK;
+            out[n].write=(v&WRITE_BIT)!=0;
+            out[n].core=(v&~WRITE_BIT)>>CORE_SHIFT;
+            out[n].pc=0;
+        }
+        return n;
+    }
+    if(fmt==TRACE_VARINT){
+        while(n<max && pos<len){
+            unsigned long long v,core=prevCore;
+            bool ok=readVarint(data,len,pos,v);
+            unsigned long long z=v>>1;
+            if(varintCores){
+                z=v>>2;
+                if(ok && (v&2)) ok=readVarint(data,len,pos,core);
+            }
+            if(!ok){
+                badLines++;
+                continue;
+            }
+            prevCore=core;
+            long long delta=(long long)(z>>1)^-(long long)(z&1);
+            prev+=delta;
+            //As in text traces; the following records of that core go too
+            if(core>USHRT_MAX){
+                badLines++;
+                continue;
+            }
+            out[n].addr=prev;
+            out[n].write=v&1;
+            out[n].core=prevCore;
+            out[n].pc=0;
+            n++;
+        }
+        return n;
+    }
+    while(n<max && pos<len){
+        const char* p=data+pos;
+        const char* eol=(const char*)memchr(p,'\n',len-pos);
+        const char* end=eol?eol:data+len;
+        pos=end-data+(eol?1:0);
+        while(p<end && (*p==' ' || *p=='\t')) p++;
+        if(p==end || *p=='#' || *p=='\r') continue;
+        bool write=false;
+        unsigned long long core=0;
+        if(*p>='0' && *p<='9'){
+            //bare address, or a core number before R/W
+            const char* q=p;
+            unsigned long long v;
+            if(!parseNumber(q,end,v)){
+                badLines++;
+                continue;
+            }
+            const char* r=q;
+            while(r<end && (*r==' ' || *r=='\t')) r++;
+            if(r>q && end-r>1 && (*r=='R' || *r=='r' || *r=='W' || *r=='w') && (r[1]==' ' || r[1]=='\t')){
+                core=v;
+                p=r;
+            }
+        }
+        if(core>USHRT_MAX){
+            badLines++;
+            continue;
+        }
+        if(*p>='0' && *p<='9'){
+            //bare address
+        }else{
+            const char* word=p;
+            while(p<end && *p!=' ' && *p!='\t') p++;
+            size_t wl=p-word;
+            if(wl==1 && (*word=='W' || *word=='w')) write=true;
+            else if(!(wl==1 && (*word=='R' || *word=='r')) && !(wl==11 && memcmp(word,"CacheAccess",11)==0)){
+                badLines++;
+                continue;
+            }
+            while(p<end && (*p==' ' || *p=='\t')) p++;
+        }
+        unsigned long long addr;
+        if(!parseNumber(p,end,addr)){
+            badLines++;
+            continue;
+        }
+        unsigned long long pc=0;
+        while(p<end && (*p==' ' || *p=='\t')) p++;
+        if(p<end && *p>='0' && *p<='9' && !parseNumber(p,end,pc)){
+            badLines++;
+            continue;
+        }
+        out[n].addr=addr;
+        out[n].write=write;
+        out[n].core=core;
+        out[n].pc=pc;
+        n++;
+    }
+    return n;
+}
+
+TraceWriter::TraceWriter(const string& path,TraceFormat fmt){
+    this->fmt=fmt;
+    prev=0;
+    prevCore=0;
+    failed=false;
+    file=fopen(path.c_str(),"wb");
+    buf.reserve(1<<16);
+    if(fmt==TRACE_RAW) buf.insert(buf.end(),RAW_MAGIC,RAW_MAGIC+8);
+    else if(fmt==TRACE_VARINT) buf.insert(buf.end(),VARINT_MAGIC,VARINT_MAGIC+8);
+}
+
+TraceWriter::~TraceWriter(){
+    close();
+}
+
+void TraceWriter::flush(){
+    if(file && !buf.empty() && fwrite(buf.data(),1,buf.size(),file)!=buf.size()) failed=true;
+    buf.clear();
+}
+
+bool TraceWriter::write(const TraceRecord& rec){
+    if(!good()) return false;
+    if(fmt==TRACE_RAW){
+        if(rec.core>RAW_MAX_CORE || rec.addr>ADDR_MASK) return false;
+        unsigned long long v=rec.addr|(unsigned long long)rec.core<<CORE_SHIFT|(rec.write?WRITE_BIT:0);
+        char b[8];
+        memcpy(b,&v,8);
+        buf.insert(buf.end(),b,b+8);
+    }else if(fmt==TRACE_VARINT){
+        long long delta=(long long)(rec.addr-prev);
+        unsigned long long z=((unsigned long long)delta<<1)^(unsigned long long)(delta>>63);
+        //z<<2 would drop the top bits of z
+        if(z>>62) return false;
+        prev=rec.addr;
+        bool coreChanged=rec.core!=prevCore;
+        prevCore=rec.core;
+        writeVarint(buf,z<<2|(coreChanged?2:0)|(rec.write?1:0));
+        if(coreChanged) writeVarint(buf,rec.core);
+    }else{
+        char line[72];
+        int l=0;
+        if(rec.core) l=snprintf(line,sizeof(line),"%u ",(unsigned)rec.core);
+        l+=snprintf(line+l,sizeof(line)-l,"%c %llu",rec.write?'W':'R',rec.addr);
+        if(rec.pc) l+=snprintf(line+l,sizeof(line)-l," 0x%llx",rec.pc);
+        line[l++]='\n';
+        buf.insert(buf.end(),line,line+l);
+    }
+    if(buf.size()>=(1<<16)) flush();
+    return !failed;
+}
+
+bool TraceWriter::close(){
+    if(!file) return false;
+    flush();
+    if(fclose(file)!=0) failed=true;
+    file=nullptr;
+    return !failed;
+}
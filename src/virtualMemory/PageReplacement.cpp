@@ -0,0 +1,434 @@
+#include "../../include/PageReplacement.h"
+#include <iostream>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <climits>
+
+void IdLists::init(int ids,int lists){
+    base=ids;
+    prev.assign(ids+lists,-1);
+    next.assign(ids+lists,-1);
+    for(int l=0;l<lists;l++){
+        prev[base+l]=base+l;
+        next[base+l]=base+l;
+    }
+}
+
+void IdLists::pushFront(int list,int id){
+    int s=base+list;
+    next[id]=next[s];
+    prev[id]=s;
+    prev[next[s]]=id;
+    next[s]=id;
+}
+
+void IdLists::remove(int id){
+    next[prev[id]]=next[id];
+    prev[next[id]]=prev[id];
+}
+
+FifoReplacer::FifoReplacer(int frames,int pages){
+    this->frames=frames;
+    ring.assign(frames,-1);
+    resident.assign(pages,0);
+}
+
+bool FifoReplacer::access(int id){
+    if(resident[id]) return true;
+    if(used==frames){
+        resident[ring[head]]=0;
+        ring[head]=id;
+        head=(head+1)%frames;
+    }else{
+        ring[used++]=id;
+    }
+    resident[id]=1;
+    return false;
+}
+
+LruReplacer::LruReplacer(int frames,int pages){
+    this->frames=frames;
+    list.init(pages,1);
+    resident.assign(pages,0);
+}
+
+bool LruReplacer::access(int id){
+    if(resident[id]){
+        list.remove(id);
+        list.pushFront(0,id);
+        return true;
+    }
+    if(used==frames){
+        int victim=list.back(0);
+        list.remove(victim);
+        resident[victim]=0;
+    }else{
+        used++;
+    }
+    list.pushFront(0,id);
+    resident[id]=1;
+    return false;
+}
+
+ClockReplacer::ClockReplacer(int frames,int pages){
+    this->frames=frames;
+    slots.assign(frames,-1);
+    resident.assign(pages,0);
+    ref.assign(pages,0);
+}
+
+bool ClockReplacer::access(int id){
+    if(resident[id]){
+        ref[id]=1;
+        return true;
+    }
+    if(used<frames){
+        slots[used++]=id;
+    }else{
+        while(ref[slots[hand]]){
+            ref[slots[hand]]=0;
+            hand=(hand+1)%frames;
+        }
+        resident[slots[hand]]=0;
+        slots[hand]=id;
+        hand=(hand+1)%frames;
+    }
+    resident[id]=1;
+    ref[id]=1;
+    return false;
+}
+
+ClockProReplacer::ClockProReplacer(int frames,int pages){
+    memMax=frames;
+    memCold=frames;
+    prev.assign(pages,-1);
+    next.assign(pages,-1);
+    type.assign(pages,NONE);
+    ref.assign(pages,0);
+    test.assign(pages,0);
+}
+
+//Links id in at the head of the clock, just behind hand hot
+void ClockProReplacer::add(int id){
+    if(handHot<0){
+        prev[id]=next[id]=id;
+        handHot=handCold=handTest=id;
+        return;
+    }
+    int p=prev[handHot];
+    prev[id]=p;
+    next[id]=handHot;
+    next[p]=id;
+    prev[handHot]=id;
+}
+
+//Unlinks id; hands on it move on to the next page
+void ClockProReplacer::del(int id){
+    if(next[id]==id){
+        handHot=handCold=handTest=-1;
+        return;
+    }
+    if(handHot==id) handHot=next[id];
+    if(handCold==id) handCold=next[id];
+    if(handTest==id) handTest=next[id];
+    next[prev[id]]=next[id];
+    prev[next[id]]=prev[id];
+}
+
+//A test period ended without a reuse: cold pages need less room
+void ClockProReplacer::endTest(int id){
+    test[id]=0;
+    if(memCold>1) memCold--;
+}
+
+//Hand cold: evicts one resident cold page. A referenced cold page is
+//promoted if it is still in its test period, and otherwise starts a new one
+//at the head of the clock.
+void ClockProReplacer::runHandCold(){
+    while(true){
+        int id=handCold;
+        handCold=next[id];
+        if(type[id]!=COLD) continue;
+        if(ref[id]){
+            ref[id]=0;
+            if(test[id]){
+                type[id]=HOT;
+                test[id]=0;
+                countCold--;
+                countHot++;
+                while(countHot>memMax-memCold) runHandHot();
+            }else{
+                test[id]=1;
+                del(id);
+                add(id);
+            }
+            continue;
+        }
+        countCold--;
+        if(test[id]){
+            type[id]=TEST;
+            countTest++;
+        }else{
+            del(id);
+            type[id]=NONE;
+        }
+        return;
+    }
+}
+
+//Hand hot: demotes one unreferenced hot page to cold, clearing reference
+//bits and ending the test periods it passes
+void ClockProReplacer::runHandHot(){
+    while(true){
+        int id=handHot;
+        handHot=next[id];
+        if(type[id]==HOT){
+            if(!ref[id]){
+                type[id]=COLD;
+                countHot--;
+                countCold++;
+                return;
+            }
+            ref[id]=0;
+        }else if(type[id]==TEST){
+            del(id);
+            type[id]=NONE;
+            countTest--;
+            endTest(id);
+        }else if(test[id]){
+            endTest(id);
+        }
+    }
+}
+
+//Hand test: retires the oldest non-resident page
+void ClockProReplacer::runHandTest(){
+    while(true){
+        int id=handTest;
+        handTest=next[id];
+        if(type[id]==TEST){
+            del(id);
+            type[id]=NONE;
+            countTest--;
+            endTest(id);
+            return;
+        }
+        if(type[id]==COLD && test[id]) endTest(id);
+    }
+}
+
+bool ClockProReplacer::access(int id){
+    if(type[id]==HOT || type[id]==COLD){
+        ref[id]=1;
+        return true;
+    }
+    if(countHot+countCold==memMax) runHandCold();
+    ref[id]=0;
+    if(type[id]==TEST){
+        //Reused within its test period: its reuse distance beats the hot
+        //pages', so it comes back hot and cold pages get more room
+        del(id);
+        countTest--;
+        if(memCold<memMax) memCold++;
+        type[id]=HOT;
+        test[id]=0;
+        add(id);
+        countHot++;
+        while(countHot>memMax-memCold) runHandHot();
+    }else{
+        type[id]=COLD;
+        test[id]=1;
+        add(id);
+        countCold++;
+    }
+    while(countTest>memMax) runHandTest();
+    return false;
+}
+
+ArcReplacer::ArcReplacer(int frames,int pages){
+    c=frames;
+    lists.init(pages,LISTS);
+    where.assign(pages,0);
+}
+
+void ArcReplacer::move(int id,int list){
+    if(where[id]){
+        lists.remove(id);
+        size[where[id]-1]--;
+    }
+    lists.pushFront(list,id);
+    where[id]=list+1;
+    size[list]++;
+}
+
+void ArcReplacer::drop(int id){
+    lists.remove(id);
+    size[where[id]-1]--;
+    where[id]=0;
+}
+
+//Evicts from T1 into B1 or from T2 into B2, whichever side is over target
+void ArcReplacer::replace(bool inB2){
+    if(size[T1]+size[T2]<c) return;
+    if(size[T1]>0 && (size[T1]>p || (inB2 && size[T1]==p))) move(lists.back(T1),B1);
+    else move(lists.back(T2),B2);
+}
+
+bool ArcReplacer::access(int id){
+    int w=where[id]-1;
+    if(w==T1 || w==T2){
+        move(id,T2);
+        return true;
+    }
+    if(w==B1){
+        p=min(c,p+max(size[B2]/size[B1],1));
+        replace(false);
+        move(id,T2);
+        return false;
+    }
+    if(w==B2){
+        p=max(0,p-max(size[B1]/size[B2],1));
+        replace(true);
+        move(id,T2);
+        return false;
+    }
+    int l1=size[T1]+size[B1];
+    if(l1==c){
+        if(size[T1]<c){
+            drop(lists.back(B1));
+            replace(false);
+        }else{
+            drop(lists.back(T1));
+        }
+    }else{
+        int total=l1+size[T2]+size[B2];
+        if(total>=c){
+            if(total==2*c) drop(lists.back(B2));
+            replace(false);
+        }
+    }
+    move(id,T1);
+    return false;
+}
+
+OptReplacer::OptReplacer(int frames,int pages,const vector<long long>& nextUse):nextUse(nextUse){
+    this->frames=frames;
+    due.assign(pages,-1);
+}
+
+bool OptReplacer::access(int id){
+    long long nu=pos<(long long)nextUse.size()?nextUse[pos]:LLONG_MAX;
+    pos++;
+    bool hit=due[id]>=0;
+    if(!hit){
+        if(used==frames){
+            while(true){
+                pair<long long,int> top=heap.top();
+                heap.pop();
+                if(due[top.second]==top.first){
+                    due[top.second]=-1;
+                    break;
+                }
+            }
+        }else{
+            used++;
+        }
+    }
+    due[id]=nu;
+    heap.push({nu,id});
+    return hit;
+}
+
+int densePages(const vector<unsigned long long>& pages,vector<int>& ids){
+    unordered_map<unsigned long long,int> map;
+    map.reserve(pages.size()/4+16);
+    ids.resize(pages.size());
+    for(size_t i=0;i<pages.size();i++) ids[i]=map.emplace(pages[i],(int)map.size()).first->second;
+    return map.size();
+}
+
+vector<long long> nextUseIndex(const vector<int>& ids,int pages){
+    vector<long long> nextUse(ids.size());
+    vector<long long> seen(pages,LLONG_MAX);
+    for(size_t i=ids.size();i-->0;){
+        nextUse[i]=seen[ids[i]];
+        seen[ids[i]]=i;
+    }
+    return nextUse;
+}
+
+unique_ptr<PageReplacer> makeReplacer(const string& name,int frames,int pages,const vector<long long>& nextUse){
+    if(name=="fifo") return unique_ptr<PageReplacer>(new FifoReplacer(frames,pages));
+    if(name=="lru") return unique_ptr<PageReplacer>(new LruReplacer(frames,pages));
+    if(name=="clock") return unique_ptr<PageReplacer>(new ClockReplacer(frames,pages));
+    if(name=="clockpro") return unique_ptr<PageReplacer>(new ClockProReplacer(frames,pages));
+    if(name=="arc") return unique_ptr<PageReplacer>(new ArcReplacer(frames,pages));
+    if(name=="opt") return unique_ptr<PageReplacer>(new OptReplacer(frames,pages,nextUse));
+    return nullptr;
+}
+
+WorkingSet workingSet(const vector<int>& ids,int pages,long long window,int samples){
+    WorkingSet ws;
+    ws.average=0;
+    ws.peak=0;
+    long long n=ids.size();
+    if(!n || window<1) return ws;
+    long long every=max(1LL,n/max(samples,1));
+    vector<long long> last(pages,-1);
+    long long distinct=0;
+    double sum=0;
+    for(long long t=0;t<n;t++){
+        //The reference leaving the window drops its page unless the page
+        //was referenced again since
+        long long out=t-window;
+        if(out>=0 && last[ids[out]]==out) distinct--;
+        if(last[ids[t]]<0 || last[ids[t]]<=out) distinct++;
+        last[ids[t]]=t;
+        sum+=distinct;
+        ws.peak=max(ws.peak,distinct);
+        if((t+1)%every==0 || t==n-1) ws.samples.push_back({t+1,distinct});
+    }
+    ws.average=sum/n;
+    return ws;
+}
+
+void comparePageReplacement(const vector<unsigned long long>& pages,int minFrames,int maxFrames,long long window,int threads){
+    vector<int> ids;
+    int distinct=densePages(pages,ids);
+    vector<long long> nextUse=nextUseIndex(ids,distinct);
+    static const char* const POLICIES[]={"fifo","lru","clock","clockpro","arc","opt"};
+    const int P=sizeof(POLICIES)/sizeof(POLICIES[0]);
+    vector<int> frameCounts;
+    for(long long f=minFrames;f<=maxFrames;f*=2) frameCounts.push_back(f);
+    //One job per (policy, frame count); results land in their own slot
+    int jobs=P*frameCounts.size();
+    vector<long long> faults(jobs,0);
+    vector<string> names(jobs);
+    atomic<int> nextJob(0);
+    auto worker=[&](){
+        int j;
+        while((j=nextJob++)<jobs){
+            unique_ptr<PageReplacer> r=makeReplacer(POLICIES[j%P],frameCounts[j/P],distinct,nextUse);
+            long long f=0;
+            for(int id:ids) f+=!r->access(id);
+            faults[j]=f;
+            names[j]=r->name();
+        }
+    };
+    threads=max(1,min(threads,jobs));
+    vector<thread> pool;
+    for(int t=1;t<threads;t++) pool.emplace_back(worker);
+    worker();
+    for(thread& t:pool) t.join();
+    cout<<"References: "<<ids.size()<<", distinct pages: "<<distinct<<"\n";
+    cout<<"policy,frames,faults,fault_rate\n";
+    for(int j=0;j<jobs;j++){
+        cout<<names[j]<<","<<frameCounts[j/P]<<","<<faults[j]<<","<<(ids.empty()?0.0:(double)faults[j]/ids.size())<<"\n";
+    }
+    WorkingSet ws=workingSet(ids,distinct,window,20);
+    cout<<"Working set (window "<<window<<"): average "<<ws.average<<", peak "<<ws.peak<<"\n";
+    cout<<"reference,working_set\n";
+    for(const pair<long long,long long>& s:ws.samples) cout<<s.first<<","<<s.second<<"\n";
+}
@@ -0,0 +1,120 @@
+#include "../../include/Tlb.h"
+#include <iostream>
+
+static const char* SIZE_NAMES[TLB_PAGE_SIZES]={"4K","2M","1G"};
+
+TlbConfig defaultTlbConfig(){
+    TlbConfig cfg;
+    cfg.l1Entries[0]=64;
+    cfg.l1Assoc[0]=4;
+    cfg.l1Entries[1]=32;
+    cfg.l1Assoc[1]=4;
+    cfg.l1Entries[2]=4;
+    cfg.l1Assoc[2]=4;
+    cfg.l2Entries=1536;
+    cfg.l2Assoc=12;
+    cfg.l2GiantEntries=16;
+    cfg.l2GiantAssoc=4;
+    cfg.pwcEntries=32;
+    cfg.l2Latency=9;
+    cfg.walkLatency=20;
+    return cfg;
+}
+
+static int sizeIndex(int pageShift){
+    for(int s=0;s<TLB_PAGE_SIZES;s++) if(TLB_SHIFTS[s]==pageShift) return s;
+    return 0;
+}
+
+static unsigned long long tlbKey(unsigned long long asid,int size,unsigned long long page){
+    return asid<<40|(unsigned long long)size<<38|page;
+}
+
+Tlb::Tlb(const TlbConfig& cfg):l2(cfg.l2Entries,1,cfg.l2Assoc),l2Giant(cfg.l2GiantEntries,1,cfg.l2GiantAssoc){
+    this->cfg=cfg;
+    for(int s=0;s<TLB_PAGE_SIZES;s++) l1.emplace_back(cfg.l1Entries[s],1,cfg.l1Assoc[s]);
+    for(int level=0;level<3;level++) pwc.emplace_back(cfg.pwcEntries,1,cfg.pwcEntries);
+}
+
+TlbOutcome Tlb::lookup(unsigned long long asid,unsigned long long vaddr,int pageShift,int& firstLevel){
+    accesses++;
+    int s=sizeIndex(pageShift);
+    unsigned long long key=tlbKey(asid,s,vaddr>>pageShift);
+    if(l1[s].access(key)){
+        l1Hits[s]++;
+        return TLB_L1_HIT;
+    }
+    l1Misses[s]++;
+    if(stlb(s).access(key)){
+        l2Hits++;
+        return TLB_L2_HIT;
+    }
+    l2Misses++;
+    //The leaf sits at level 3 for 4 KiB pages, 2 for 2 MiB, 1 for 1 GiB;
+    //the page-walk cache entry at level k is keyed by the address bits that
+    //select it
+    int leaf=3-s;
+    firstLevel=0;
+    for(int k=leaf-1;k>=0;k--){
+        if(pwc[k].lookup(tlbKey(asid,0,vaddr>>(12+(3-k)*9)))){
+            pwcHits[k]++;
+            firstLevel=k+1;
+            break;
+        }
+    }
+    for(int k=firstLevel;k<leaf;k++) pwc[k].access(tlbKey(asid,0,vaddr>>(12+(3-k)*9)));
+    walkReads+=leaf-firstLevel+1;
+    return TLB_WALK;
+}
+
+void Tlb::invalidate(unsigned long long asid,unsigned long long vaddr,int pageShift){
+    int s=sizeIndex(pageShift);
+    unsigned long long key=tlbKey(asid,s,vaddr>>pageShift);
+    bool dirty;
+    bool hit=l1[s].invalidate(key,dirty);
+    if(stlb(s).invalidate(key,dirty) || hit) shootdowns++;
+}
+
+void Tlb::invalidateWalk(unsigned long long asid,unsigned long long vaddr,int level){
+    bool dirty;
+    pwc[level].invalidate(tlbKey(asid,0,vaddr>>(12+(3-level)*9)),dirty);
+}
+
+static void printReach(long long bytes){
+    if(bytes>=1LL<<30) std::cout<<(bytes>>30)<<" GiB";
+    else if(bytes>=1LL<<20) std::cout<<(bytes>>20)<<" MiB";
+    else std::cout<<(bytes>>10)<<" KiB";
+}
+
+void Tlb::stats() const{
+    std::cout<<"TLB: "<<accesses<<" translations\n";
+    for(int s=0;s<TLB_PAGE_SIZES;s++){
+        long long n=l1Hits[s]+l1Misses[s];
+        if(!n) continue;
+        std::cout<<"L1 dTLB "<<SIZE_NAMES[s]<<" ("<<cfg.l1Entries[s]<<" entries, "<<cfg.l1Assoc[s]<<"-way): "<<l1Hits[s]<<" hits, "<<l1Misses[s]<<" misses, miss rate "<<(double)l1Misses[s]/n<<"\n";
+    }
+    long long l2n=l2Hits+l2Misses;
+    std::cout<<"STLB ("<<cfg.l2Entries<<" entries, "<<cfg.l2Assoc<<"-way + "<<cfg.l2GiantEntries<<" 1G): "<<l2Hits<<" hits, "<<l2Misses<<" misses";
+    if(l2n) std::cout<<", miss rate "<<(double)l2Misses/l2n;
+    std::cout<<"\n";
+    std::cout<<"Page walks: "<<l2Misses<<", "<<walkReads<<" table reads (page-walk cache hits: PML4E "<<pwcHits[0]<<", PDPTE "<<pwcHits[1]<<", PDE "<<pwcHits[2]<<")\n";
+    long long cycles=l2Hits*cfg.l2Latency+walkCycles;
+    std::cout<<"Walk cycles: "<<walkCycles;
+    if(l2Misses) std::cout<<" ("<<(double)walkCycles/l2Misses<<" per walk)";
+    if(accesses) std::cout<<", translation cycles per access: "<<(double)cycles/accesses;
+    std::cout<<"\n";
+    std::cout<<"TLB reach: L1 ";
+    printReach((long long)cfg.l1Entries[0]<<12);
+    std::cout<<" / ";
+    printReach((long long)cfg.l1Entries[1]<<21);
+    std::cout<<" / ";
+    printReach((long long)cfg.l1Entries[2]<<30);
+    std::cout<<", STLB ";
+    printReach((long long)cfg.l2Entries<<12);
+    std::cout<<" / ";
+    printReach((long long)cfg.l2Entries<<21);
+    std::cout<<" / ";
+    printReach((long long)cfg.l2GiantEntries<<30);
+    std::cout<<" (4K / 2M / 1G pages)\n";
+    if(shootdowns) std::cout<<"Shootdowns: "<<shootdowns<<"\n";
+}
@@ -0,0 +1,412 @@
+#include "../../include/VirtualMemory.h"
+#include "../../include/MultilevelCache.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+static unsigned long long arenaBytes(int frameCount){
+    unsigned long long bytes=PAGE_SIZE;
+    while(bytes<(unsigned long long)frameCount*PAGE_SIZE) bytes<<=1;
+    return bytes;
+}
+
+VirtualMemory::VirtualMemory(int frameCount):frameArena(arenaBytes(frameCount),PAGE_SHIFT){
+    this->frameCount=frameCount;
+    framesUsed=0;
+    tableBase=arenaBytes(frameCount);
+    frames.assign(tableBase>>PAGE_SHIFT,Frame{-1,0,nullptr,0});
+    hand=0;
+    nextAsid=1;
+    lastPid=-1;
+    lastSpace=nullptr;
+    evictions=0;
+    dirtyEvictions=0;
+    thp=THP_NEVER;
+    giant=false;
+    promoteThreshold=PT_ENTRIES;
+    promotions=0;
+    hugeFallbacks=0;
+    tlb=nullptr;
+}
+
+void VirtualMemory::setHugePages(ThpMode mode,bool giant,int promoteThreshold){
+    thp=mode;
+    this->giant=giant;
+    this->promoteThreshold=promoteThreshold;
+}
+
+void VirtualMemory::attachTlb(Tlb* tlb){
+    this->tlb=tlb;
+}
+
+int VirtualMemory::newNode(){
+    int idx;
+    if(!freeNodes.empty()){
+        idx=freeNodes.back();
+        freeNodes.pop_back();
+    }else{
+        idx=nodes.size();
+        nodes.emplace_back(new PageTableNode);
+    }
+    memset(nodes[idx]->e,0,sizeof(nodes[idx]->e));
+    nodes[idx]->used=0;
+    nodes[idx]->collapseWait=0;
+    return idx;
+}
+
+AddressSpace* VirtualMemory::space(int pid,bool create){
+    //lastSpace is null while nothing is cached, whatever lastPid holds
+    if(lastSpace && pid==lastPid) return lastSpace;
+    auto it=spaces.find(pid);
+    if(it==spaces.end()){
+        if(!create) return nullptr;
+        AddressSpace as;
+        as.root=newNode();
+        as.asid=nextAsid++;
+        as.lastPage=~0ULL;
+        as.lastShift=PAGE_SHIFT;
+        as.lastPte=nullptr;
+        as.accesses=0;
+        as.minorFaults=0;
+        as.majorFaults=0;
+        as.segfaults=0;
+        as.residentPages=0;
+        as.hugePages=0;
+        as.giantPages=0;
+        as.tableNodes=1;
+        it=spaces.emplace(pid,as).first;
+    }
+    lastPid=pid;
+    lastSpace=&it->second;
+    return lastSpace;
+}
+
+bool VirtualMemory::createProcess(int pid){
+    if(spaces.count(pid)) return false;
+    space(pid,true);
+    return true;
+}
+
+void VirtualMemory::freeTable(int node,int level){
+    PageTableNode& n=*nodes[node];
+    for(int i=0;i<PT_ENTRIES;i++){
+        unsigned long long e=n.e[i];
+        if(!(e&PTE_PRESENT)) continue;
+        unsigned long long num=e>>PAGE_SHIFT;
+        if(level+1<PT_LEVELS && !(e&PTE_HUGE)){
+            freeTable(num,level+1);
+        }else{
+            frameArena.free(num<<PAGE_SHIFT);
+            frames[num]=Frame{-1,0,nullptr,0};
+            framesUsed-=1<<((PT_LEVELS-1-level)*PT_BITS);
+        }
+    }
+    freeNodes.push_back(node);
+}
+
+bool VirtualMemory::destroyProcess(int pid){
+    auto it=spaces.find(pid);
+    if(it==spaces.end()) return false;
+    //The TLBs need no flush: a new process with this pid gets a new asid
+    freeTable(it->second.root,0);
+    spaces.erase(it);
+    lastPid=-1;
+    lastSpace=nullptr;
+    return true;
+}
+
+//Clock: clears accessed bits until it finds a page without one and swaps
+//that page out, huge pages whole
+void VirtualMemory::evictOne(){
+    int n=frames.size();
+    while(true){
+        Frame& f=frames[hand];
+        int cur=hand;
+        hand=(hand+1)%n;
+        if(!f.pte) continue;
+        if(*f.pte&PTE_ACCESSED){
+            *f.pte&=~PTE_ACCESSED;
+            continue;
+        }
+        evictions++;
+        if(*f.pte&PTE_DIRTY) dirtyEvictions++;
+        int pages=1<<(f.shift-PAGE_SHIFT);
+        AddressSpace& as=spaces[f.pid];
+        as.residentPages-=pages;
+        if(f.shift==HUGE_SHIFT) as.hugePages--;
+        if(f.shift==GIANT_SHIFT) as.giantPages--;
+        *f.pte=PTE_SWAPPED|(f.shift>PAGE_SHIFT?PTE_HUGE:0);
+        if(tlb) tlb->invalidate(as.asid,f.vpn<<PAGE_SHIFT,f.shift);
+        frameArena.free((unsigned long long)cur<<PAGE_SHIFT);
+        framesUsed-=pages;
+        f=Frame{-1,0,nullptr,0};
+        return;
+    }
+}
+
+//A free 4 KiB frame, evicting when none is left
+int VirtualMemory::takeFrame(){
+    while(true){
+        if(framesUsed<frameCount){
+            long long off=frameArena.access(PAGE_SIZE);
+            if(off>=0){
+                framesUsed++;
+                return off>>PAGE_SHIFT;
+            }
+        }
+        evictOne();
+    }
+}
+
+//First frame of a free, aligned huge block, or -1. Never evicts: a fault
+//that cannot get one falls back to 4 KiB pages.
+int VirtualMemory::takeHuge(int shift){
+    int pages=1<<(shift-PAGE_SHIFT);
+    if(framesUsed+pages>frameCount) return -1;
+    long long off=frameArena.access(1ULL<<shift);
+    if(off<0) return -1;
+    framesUsed+=pages;
+    return off>>PAGE_SHIFT;
+}
+
+void VirtualMemory::map(AddressSpace& as,int pid,unsigned long long* pte,unsigned long long vaddr,int frame,int shift){
+    unsigned long long vpn=vaddr>>shift<<(shift-PAGE_SHIFT);
+    frames[frame]=Frame{pid,vpn,pte,shift};
+    *pte=((unsigned long long)frame<<PAGE_SHIFT)|PTE_PRESENT|(shift>PAGE_SHIFT?PTE_HUGE:0);
+    as.residentPages+=1<<(shift-PAGE_SHIFT);
+    if(shift==HUGE_SHIFT) as.hugePages++;
+    if(shift==GIANT_SHIFT) as.giantPages++;
+    as.lastPage=vaddr>>shift;
+    as.lastShift=shift;
+    as.lastPte=pte;
+}
+
+//khugepaged: replaces the last-level table node under pde with one 2 MiB
+//page. The region's 4 KiB frames are released first, so they count towards
+//the huge block; if none can be had they are taken back. A region with a
+//swapped-out page is left alone: the huge page would lose its contents.
+bool VirtualMemory::collapse(AddressSpace& as,int pid,unsigned long long* pde,int node,unsigned long long vaddr){
+    PageTableNode& n=*nodes[node];
+    int resident=0;
+    for(int i=0;i<PT_ENTRIES;i++){
+        if(n.e[i]&PTE_SWAPPED) return false;
+        if(n.e[i]&PTE_PRESENT) resident++;
+    }
+    if(framesUsed-resident+PT_ENTRIES>frameCount) return false;
+    unsigned long long base=vaddr>>HUGE_SHIFT<<HUGE_SHIFT;
+    for(int i=0;i<PT_ENTRIES;i++){
+        unsigned long long e=n.e[i];
+        if(!(e&PTE_PRESENT)) continue;
+        unsigned long long f=e>>PAGE_SHIFT;
+        frameArena.free(f<<PAGE_SHIFT);
+        frames[f]=Frame{-1,0,nullptr,0};
+        framesUsed--;
+    }
+    int frame=takeHuge(HUGE_SHIFT);
+    if(frame<0){
+        //The frames just freed are free again, though Buddy may hand back
+        //different ones
+        for(int i=0;i<PT_ENTRIES;i++){
+            unsigned long long e=n.e[i];
+            if(!(e&PTE_PRESENT)) continue;
+            unsigned long long f=frameArena.access(PAGE_SIZE)>>PAGE_SHIFT;
+            frames[f]=Frame{pid,(base>>PAGE_SHIFT)+i,&n.e[i],PAGE_SHIFT};
+            framesUsed++;
+            n.e[i]=(f<<PAGE_SHIFT)|(e&((1ULL<<PAGE_SHIFT)-1));
+            if(tlb && f!=e>>PAGE_SHIFT) tlb->invalidate(as.asid,base+((unsigned long long)i<<PAGE_SHIFT),PAGE_SHIFT);
+        }
+        return false;
+    }
+    unsigned long long dirty=0;
+    for(int i=0;i<PT_ENTRIES;i++){
+        unsigned long long e=n.e[i];
+        if(!(e&PTE_PRESENT)) continue;
+        dirty|=e&PTE_DIRTY;
+        as.residentPages--;
+        if(tlb) tlb->invalidate(as.asid,base+((unsigned long long)i<<PAGE_SHIFT),PAGE_SHIFT);
+    }
+    freeNodes.push_back(node);
+    as.tableNodes--;
+    if(tlb) tlb->invalidateWalk(as.asid,base,PT_LEVELS-2);
+    map(as,pid,pde,vaddr,frame,HUGE_SHIFT);
+    *pde|=PTE_ACCESSED|dirty;
+    promotions++;
+    return true;
+}
+
+//Slow path of translate(): walks to the leaf mapping vaddr, creating tables
+//and paging in on the way, and leaves it in the last-translation cache
+TranslateResult VirtualMemory::fault(AddressSpace& as,int pid,unsigned long long vaddr){
+    int node=as.root;
+    unsigned long long* pde=nullptr;
+    bool swapped=false;   //the region was a swapped-out huge page
+    for(int level=0;;level++){
+        int shift=PAGE_SHIFT+(PT_LEVELS-1-level)*PT_BITS;
+        int idx=(vaddr>>shift)&(PT_ENTRIES-1);
+        unsigned long long* e=&nodes[node]->e[idx];
+        if((*e&PTE_PRESENT) && (level==PT_LEVELS-1 || (*e&PTE_HUGE))){
+            as.lastPage=vaddr>>shift;
+            as.lastShift=shift;
+            as.lastPte=e;
+            return XLATE_HIT;
+        }
+        if(level==PT_LEVELS-1){
+            TranslateResult res=(swapped || (*e&PTE_SWAPPED))?XLATE_MAJOR_FAULT:XLATE_MINOR_FAULT;
+            if(res==XLATE_MAJOR_FAULT) as.majorFaults++;
+            else as.minorFaults++;
+            if(!*e) nodes[node]->used++;
+            //takeFrame() may evict one of this space's own pages, but never
+            //the one being faulted in, so e stays valid
+            map(as,pid,e,vaddr,takeFrame(),PAGE_SHIFT);
+            //A failed collapse is retried only after PT_ENTRIES more faults
+            //in the region, so its scans cost O(1) per fault
+            PageTableNode& n=*nodes[node];
+            if(thp==THP_PROMOTE && n.used>=promoteThreshold){
+                if(n.collapseWait>0) n.collapseWait--;
+                else if(!collapse(as,pid,pde,node,vaddr)) n.collapseWait=PT_ENTRIES;
+            }
+            return res;
+        }
+        if(*e&PTE_HUGE){
+            //A swapped-out huge page comes back whole if a block is free,
+            //otherwise its region restarts on 4 KiB pages
+            int frame=takeHuge(shift);
+            if(frame>=0){
+                as.majorFaults++;
+                map(as,pid,e,vaddr,frame,shift);
+                return XLATE_MAJOR_FAULT;
+            }
+            hugeFallbacks++;
+            swapped=true;
+            *e=0;
+        }else if(!(*e&PTE_PRESENT)){
+            bool hugeOk=(level==PT_LEVELS-2 && thp==THP_ALWAYS) || (level==PT_LEVELS-3 && giant);
+            if(hugeOk){
+                int frame=takeHuge(shift);
+                if(frame>=0){
+                    as.minorFaults++;
+                    map(as,pid,e,vaddr,frame,shift);
+                    return XLATE_MINOR_FAULT;
+                }
+                if(level==PT_LEVELS-2) hugeFallbacks++;
+            }
+        }
+        if(!(*e&PTE_PRESENT)){
+            int child=newNode();
+            *e=((unsigned long long)child<<PAGE_SHIFT)|PTE_PRESENT;
+            as.tableNodes++;
+        }
+        if(level==PT_LEVELS-2) pde=e;
+        node=*e>>PAGE_SHIFT;
+    }
+}
+
+TranslateResult VirtualMemory::translate(int pid,unsigned long long vaddr,bool write,unsigned long long& paddr,int& pageShift){
+    AddressSpace& as=*space(pid,true);
+    as.accesses++;
+    TranslateResult res=XLATE_HIT;
+    if((vaddr>>as.lastShift)!=as.lastPage || !(*as.lastPte&PTE_PRESENT)){
+        if(vaddr>>VA_BITS){
+            as.segfaults++;
+            return XLATE_SEGFAULT;
+        }
+        res=fault(as,pid,vaddr);
+    }
+    unsigned long long* pte=as.lastPte;
+    *pte|=PTE_ACCESSED|(write?PTE_DIRTY:0);
+    pageShift=as.lastShift;
+    paddr=(*pte>>PAGE_SHIFT<<PAGE_SHIFT)|(vaddr&((1ULL<<pageShift)-1));
+    return res;
+}
+
+TranslateResult VirtualMemory::translate(int pid,unsigned long long vaddr,bool write,unsigned long long& paddr){
+    int shift;
+    return translate(pid,vaddr,write,paddr,shift);
+}
+
+//Runs a translation through the TLBs; the page table entries a miss reads
+//go through cache, if given, and their latency is charged to the walk
+TlbOutcome VirtualMemory::tlbAccess(AddressSpace& as,unsigned long long vaddr,int shift,MultilevelCache* cache){
+    int first;
+    TlbOutcome res=tlb->lookup(as.asid,vaddr,shift,first);
+    if(res!=TLB_WALK) return res;
+    int leaf=PT_LEVELS-1-(shift-PAGE_SHIFT)/PT_BITS;
+    long long cycles=0;
+    int node=as.root;
+    for(int level=0;level<=leaf;level++){
+        int idx=(vaddr>>(PAGE_SHIFT+(PT_LEVELS-1-level)*PT_BITS))&(PT_ENTRIES-1);
+        if(level>=first){
+            if(cache){
+                long long before=cache->getCycles();
+                cache->lookup(tableBase+(unsigned long long)node*PAGE_SIZE+idx*sizeof(unsigned long long));
+                cycles+=cache->getCycles()-before;
+            }else{
+                cycles+=tlb->getWalkLatency();
+            }
+        }
+        node=nodes[node]->e[idx]>>PAGE_SHIFT;
+    }
+    tlb->addWalkCycles(cycles);
+    return res;
+}
+
+void VirtualMemory::access(int pid,unsigned long long vaddr,bool write){
+    unsigned long long paddr;
+    int shift;
+    TranslateResult res=translate(pid,vaddr,write,paddr,shift);
+    if(res==XLATE_SEGFAULT){
+        cout<<"Segmentation fault: pid "<<pid<<" address "<<vaddr<<"\n";
+        return;
+    }
+    cout<<"pid "<<pid<<": VA "<<vaddr<<" -> PA "<<paddr;
+    if(shift==HUGE_SHIFT) cout<<" [2M page]";
+    if(shift==GIANT_SHIFT) cout<<" [1G page]";
+    if(res==XLATE_MINOR_FAULT) cout<<" (page fault)";
+    else if(res==XLATE_MAJOR_FAULT) cout<<" (page fault, swapped in)";
+    if(tlb){
+        TlbOutcome t=tlbAccess(*lastSpace,vaddr,shift,nullptr);
+        if(t==TLB_L1_HIT) cout<<" dTLB hit";
+        else if(t==TLB_L2_HIT) cout<<" STLB hit";
+        else cout<<" TLB miss";
+    }
+    cout<<"\n";
+}
+
+long long VirtualMemory::replay(TraceReader& trace,MultilevelCache* cache){
+    static const size_t BATCH=4096;
+    TraceRecord recs[BATCH];
+    long long total=0;
+    size_t n;
+    while((n=trace.read(recs,BATCH))>0){
+        for(size_t i=0;i<n;i++){
+            unsigned long long paddr;
+            int shift;
+            if(translate(recs[i].core,recs[i].addr,recs[i].write,paddr,shift)==XLATE_SEGFAULT) continue;
+            if(tlb) tlbAccess(*lastSpace,recs[i].addr,shift,cache);
+            if(cache) cache->lookup(paddr,recs[i].write,recs[i].pc);
+        }
+        total+=n;
+    }
+    return total;
+}
+
+void VirtualMemory::stats(){
+    cout<<"Virtual memory: "<<PAGE_SIZE<<"-byte pages, "<<framesUsed<<"/"<<frameCount<<" frames in use\n";
+    vector<int> pids;
+    for(const pair<const int,AddressSpace>& s:spaces) pids.push_back(s.first);
+    sort(pids.begin(),pids.end());
+    for(int pid:pids){
+        const AddressSpace& as=spaces[pid];
+        cout<<"Process "<<pid<<": "<<as.accesses<<" accesses, "<<as.minorFaults<<" page faults, "<<as.majorFaults<<" swap-ins, ";
+        cout<<as.residentPages<<" resident pages, "<<as.tableNodes<<" page table nodes";
+        if(as.hugePages || as.giantPages) cout<<", "<<as.hugePages<<" 2M and "<<as.giantPages<<" 1G pages mapped";
+        if(as.segfaults) cout<<", "<<as.segfaults<<" segfaults";
+        cout<<"\n";
+    }
+    cout<<"Evictions: "<<evictions<<" ("<<dirtyEvictions<<" dirty)\n";
+    if(thp!=THP_NEVER || giant){
+        cout<<"Huge pages: "<<(thp==THP_ALWAYS?"always":thp==THP_PROMOTE?"promote":"never")<<(giant?" + 1G":"");
+        cout<<", "<<promotions<<" promotions, "<<hugeFallbacks<<" fallbacks to 4K\n";
+    }
+    if(tlb) tlb->stats();
+}
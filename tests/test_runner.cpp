@@ -1,13 +1,50 @@
+// End-to-end test runner. Every test is one command type of
+// tests/test_cases.txt (WORKLOAD, CACHE, VIRTUAL), run in file order on a
+// fresh Simulator linked in-process. A test passes when
+//  - every command's output matches its entry in tests/expected_outputs.txt,
+//  - the whole transcript equals the golden file tests/golden/<type>.out, and
+//  - with --perf, its throughput, measured by replaying it with output
+//    suppressed, has not dropped below the baseline in
+//    tests/perf_baseline.txt by more than the regression threshold. The
+//    baseline is recorded on the machine running the gate (--update-baseline);
+//    types it does not list only report their throughput.
+// After them come the threaded tests that commands cannot drive, which call
+// the allocators directly (SLAB_RACE), and the setups the simulator's fixed
+// sizes cannot reach (THP_COLLAPSE), and the sharded cache replay checked
+// against the serial one for every policy (CACHE_SHARDS), and the one-pass
+// LRU sweep checked against a replay of every configuration (SWEEP_LRU), and
+// the page replacement policies' fault counts on Belady's anomaly string
+// (PAGE_FAULTS), the trace formats' round trip and malformed records
+// (TRACE_FORMATS), and MESI transitions of shared blocks with the parallel
+// epochs checked against a serial replay (COHERENCE). Last, every test type's
+// commands run once more as a --batch file, whose output must equal the golden
+// transcript without its prompts (BATCH).
+//
+// Usage: test_runner [--update-golden] [--update-baseline] [--threshold <f>] [--perf|--no-perf]
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <map>
 #include <unordered_map>
 #include <chrono>
 #include <cstdlib>
-#include <signal.h>
+#include <thread>
+#include <atomic>
+#include <set>
+#include <type_traits>
+#include <filesystem>
 #include <unistd.h>
+#include <fcntl.h>
+#include "../include/Simulator.h"
+#include "../include/Cache.h"
+#include "../include/StackDistance.h"
+#include "../include/PageReplacement.h"
+#include "../include/Trace.h"
+#include "../include/Coherence.h"
+#include "../include/SlabAllocator.h"
+#include "../include/VirtualMemory.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -16,23 +53,77 @@ struct TestResult
 {
     string testName;
     bool passed;
-    double executionTime;
+    double executionTime; // ms, for the checked run
     int commandsExecuted;
+    double opsPerSecond; // 0 when not measured
     string errorMessage;
 };
 
-struct ExpectedOutput
+// One step of an expectation: the output must contain any (or all) of texts
+struct ExpectedStep
 {
-    string command;
-    vector<string> expectedPatterns;
-    bool caseSensitive;
+    bool all;
+    vector<string> texts;
+};
+
+struct TestCase
+{
+    string type;
+    vector<string> commands;
 };
 
 class TestRunner
 {
 private:
     vector<TestResult> results;
-    unordered_map<string, ExpectedOutput> expectedOutputs;
+    // "<TYPE> <command>" -> steps; the n-th run of a command is checked
+    // against step n, or the last step once they run out
+    unordered_map<string, vector<ExpectedStep>> expectedOutputs;
+    map<string, double> baseline;
+    bool updateGolden;
+    bool updateBaseline;
+    bool measurePerf;
+    double threshold;
+
+    static string trim(const string &s)
+    {
+        size_t start = s.find_first_not_of(" \t\r");
+        if (start == string::npos)
+            return "";
+        size_t end = s.find_last_not_of(" \t\r");
+        return s.substr(start, end - start + 1);
+    }
+
+    // Parses `[Contains] "a" or "b"`, `"a" and "b"` and `"a" then "b"`;
+    // anything outside the quotes other than the connectives is commentary
+    static vector<ExpectedStep> parsePattern(const string &pattern)
+    {
+        vector<ExpectedStep> steps(1, ExpectedStep{false, {}});
+        size_t pos = 0;
+        string connective;
+        while (true)
+        {
+            size_t open = pattern.find('"', pos);
+            if (open == string::npos)
+                break;
+            size_t close = pattern.find('"', open + 1);
+            if (close == string::npos)
+                break;
+            connective = trim(pattern.substr(pos, open - pos));
+            if (!steps.back().texts.empty())
+            {
+                if (connective == "then")
+                    steps.push_back(ExpectedStep{false, {}});
+                else if (connective == "and")
+                    steps.back().all = true;
+            }
+            steps.back().texts.push_back(pattern.substr(open + 1, close - open - 1));
+            pos = close + 1;
+        }
+        if (steps.back().texts.empty())
+            steps.pop_back();
+        return steps;
+    }
 
     void loadExpectedOutputs(const string &filename)
     {
@@ -42,286 +133,793 @@ private:
             cerr << "Warning: Could not open expected outputs file: " << filename << endl;
             return;
         }
-
-        string line;
-        string currentCommand;
-        string currentPattern;
-
+        string line, currentCommand;
         while (getline(file, line))
         {
+            line = trim(line);
             if (line.empty() || line[0] == '#')
                 continue;
-
-            if (line.find(':') != string::npos)
+            if (line.compare(0, 9, "Expected:") == 0)
             {
-                if (!currentCommand.empty() && !currentPattern.empty())
-                {
-                    ExpectedOutput expected;
-                    expected.command = currentCommand;
-                    expected.expectedPatterns.push_back(currentPattern);
-                    expected.caseSensitive = false;
-                    expectedOutputs[currentCommand] = expected;
-                }
-                size_t colonPos = line.find(':');
-                currentCommand = line.substr(0, colonPos);
-
-                string patternLine = line.substr(colonPos + 1);
-                size_t expectedPos = patternLine.find("Expected:");
-                if (expectedPos != string::npos)
-                {
-                    currentPattern = patternLine.substr(expectedPos + 9);
-
-                    size_t start = currentPattern.find_first_not_of(" \t");
-                    size_t end = currentPattern.find_last_not_of(" \t");
-                    if (start != string::npos && end != string::npos)
-                    {
-                        currentPattern = currentPattern.substr(start, end - start + 1);
-                    }
-                }
+                if (currentCommand.empty())
+                    continue;
+                vector<ExpectedStep> steps = parsePattern(line.substr(9));
+                auto &all = expectedOutputs[currentCommand];
+                all.insert(all.end(), steps.begin(), steps.end());
+            }
+            else if (line.back() == ':')
+            {
+                currentCommand = trim(line.substr(0, line.size() - 1));
             }
         }
+    }
 
-        if (!currentCommand.empty() && !currentPattern.empty())
+    void loadBaseline(const string &filename)
+    {
+        ifstream file(filename);
+        string type;
+        double ops;
+        while (file >> type >> ops)
+            baseline[type] = ops;
+    }
+
+    void saveBaseline(const string &filename)
+    {
+        ofstream file(filename);
+        for (const auto &b : baseline)
+            file << b.first << ' ' << b.second << '\n';
+    }
+
+    // Groups the commands of a test file by type, keeping file order
+    vector<TestCase> loadTestCases(const string &filename)
+    {
+        vector<TestCase> tests;
+        ifstream file(filename);
+        string line;
+        while (getline(file, line))
         {
-            ExpectedOutput expected;
-            expected.command = currentCommand;
-            expected.expectedPatterns.push_back(currentPattern);
-            expected.caseSensitive = false;
-            expectedOutputs[currentCommand] = expected;
+            line = trim(line);
+            if (line.empty() || line[0] == '#')
+                continue;
+            size_t space = line.find(' ');
+            if (space == string::npos)
+                continue;
+            string type = line.substr(0, space);
+            size_t t = 0;
+            while (t < tests.size() && tests[t].type != type)
+                t++;
+            if (t == tests.size())
+                tests.push_back(TestCase{type, {}});
+            tests[t].commands.push_back(trim(line.substr(space + 1)));
         }
-
-        file.close();
+        return tests;
     }
 
-    string getTestType(const string &filename)
+    static string getTestType(const string &type)
     {
-        if (filename.find("workload") != string::npos)
+        if (type == "WORKLOAD")
             return "Memory Allocation";
-        if (filename.find("cache") != string::npos)
+        if (type == "CACHE")
             return "Cache Access";
-        if (filename.find("virtual") != string::npos)
+        if (type == "VIRTUAL")
             return "Virtual Address";
         return "Unknown";
     }
 
-    bool validateOutput(const string &command, const string &output)
+    static bool matches(const ExpectedStep &step, const string &output)
     {
-        string cleanCommand = command;
-        size_t spacePos = cleanCommand.find(' ');
-        if (spacePos != string::npos)
+        for (const string &text : step.texts)
         {
-            cleanCommand = cleanCommand.substr(spacePos + 1);
+            bool found = output.find(text) != string::npos;
+            if (found && !step.all)
+                return true;
+            if (!found && step.all)
+                return false;
         }
+        return step.all;
+    }
 
-        auto it = expectedOutputs.find(cleanCommand);
-        if (it != expectedOutputs.end())
+    bool validateOutput(const string &key, int occurrence, const string &output, string &error)
+    {
+        if (output.find("Unknown command") != string::npos || output.find("Usage:") != string::npos)
         {
-            const ExpectedOutput &expected = it->second;
-            for (const string &pattern : expected.expectedPatterns)
-            {
-                if (pattern.find("Contains") != string::npos)
-                {
-                    size_t containsPos = pattern.find("Contains");
-                    if (containsPos != string::npos)
-                    {
-                        string searchText = pattern.substr(containsPos + 8);
-                        if (searchText.front() == '"' && searchText.back() == '"')
-                        {
-                            searchText = searchText.substr(1, searchText.length() - 2);
-                        }
-
-                        if (output.find(searchText) != string::npos)
-                        {
-                            return true;
-                        }
-                    }
-                }
-                else if (output.find(pattern) != string::npos)
-                {
-                    return true;
-                }
-            }
+            error = "command rejected";
             return false;
         }
+        auto it = expectedOutputs.find(key);
+        if (it == expectedOutputs.end())
+            return true;
+        const vector<ExpectedStep> &steps = it->second;
+        const ExpectedStep &step = steps[min(occurrence, (int)steps.size() - 1)];
+        if (matches(step, output))
+            return true;
+        error = "expected " + string(step.all ? "all of" : "one of");
+        for (const string &text : step.texts)
+            error += " \"" + text + "\"";
+        return false;
+    }
 
-        if (command.find("malloc") != string::npos)
+    // Runs the test on a fresh simulator, checking each command's output and
+    // collecting the transcript
+    bool runChecked(const TestCase &test, TestResult &result, string &transcript)
+    {
+        Simulator sim;
+        unordered_map<string, int> seen;
+        ostringstream output;
+        streambuf *console = cout.rdbuf(output.rdbuf());
+        bool ok = true;
+        auto start = steady_clock::now();
+        for (const string &command : test.commands)
         {
-            return output.find("Allocated") != string::npos ||
-                   output.find("Allocation failed") != string::npos;
+            output.str("");
+            sim.execute(command);
+            string out = output.str();
+            transcript += "mem> " + command + "\n" + out;
+            string key = test.type + " " + command;
+            string error;
+            if (ok && !validateOutput(key, seen[key]++, out, error))
+            {
+                ok = false;
+                result.errorMessage = "Command validation failed: " + command + ": " + error + "; got: " + trim(out);
+            }
+            result.commandsExecuted++;
         }
-        else if (command.find("free") != string::npos)
+        result.executionTime = duration<double, milli>(steady_clock::now() - start).count();
+        cout.rdbuf(console);
+        return ok;
+    }
+
+    bool checkGolden(const TestCase &test, const string &transcript, TestResult &result)
+    {
+        string path = "tests/golden/" + test.type + ".out";
+        if (updateGolden)
         {
-            return output.find("Freed") != string::npos || output.find("freed") != string::npos;
+            ofstream file(path);
+            file << transcript;
+            return true;
         }
-        else if (command.find("CacheAccess") != string::npos)
+        ifstream file(path);
+        if (!file.is_open())
         {
-            return output.find("error") == string::npos && output.find("Error") == string::npos;
+            result.errorMessage = "Missing golden output " + path + " (run with --update-golden)";
+            return false;
         }
-        else if (command.find("BuddyAlloc") != string::npos)
+        stringstream golden;
+        golden << file.rdbuf();
+        string expected = golden.str();
+        if (expected == transcript)
+            return true;
+        // Report the first line that differs
+        istringstream a(expected), b(transcript);
+        string la, lb;
+        int line = 1;
+        while (true)
         {
-            return output.find("buddy allocated") != string::npos ||
-                   output.find("Buddy allocation failed") != string::npos;
+            bool ea = !getline(a, la), eb = !getline(b, lb);
+            if (ea || eb || la != lb)
+            {
+                result.errorMessage = path + " line " + to_string(line) + ": expected \"" + (ea ? "<end>" : la) + "\", got \"" +
+                                      (eb ? "<end>" : lb) + "\"";
+                break;
+            }
+            line++;
         }
-        else if (command.find("dump") != string::npos || command.find("stats") != string::npos)
+        return false;
+    }
+
+    // Replays the test with output suppressed on fresh simulators until at
+    // least 200 ms have gone by, timing only the commands
+    double measureThroughput(const TestCase &test)
+    {
+        // Output goes through a failed stream, so nothing is formatted
+        cout.setstate(ios::badbit);
+        vector<CommandArgs> parsed(test.commands.size());
+        for (size_t i = 0; i < test.commands.size(); i++)
+            splitCommand(test.commands[i].data(), test.commands[i].data() + test.commands[i].size(), parsed[i]);
+        double secs = 0;
+        long long ops = 0;
+        while (secs < 0.2)
         {
-            return !output.empty();
+            Simulator sim;
+            auto start = steady_clock::now();
+            for (const CommandArgs &args : parsed)
+                sim.execute(args);
+            secs += duration<double>(steady_clock::now() - start).count();
+            ops += parsed.size();
         }
-        return true;
+        cout.clear();
+        return ops / secs;
     }
 
-    string executeCommand(const string &command)
+    TestResult runTest(const TestCase &test)
     {
-        ostringstream output;
+        TestResult result;
+        result.testName = test.type;
+        result.passed = true;
+        result.executionTime = 0.0;
+        result.commandsExecuted = 0;
+        result.opsPerSecond = 0;
+
+        string transcript;
+        result.passed = runChecked(test, result, transcript);
+        if (result.passed)
+            result.passed = checkGolden(test, transcript, result);
+        if (!measurePerf)
+            return result;
 
-        if (command.find("malloc") != string::npos)
+        result.opsPerSecond = measureThroughput(test);
+        if (updateBaseline)
+        {
+            baseline[test.type] = result.opsPerSecond;
+        }
+        else if (baseline.count(test.type))
         {
-            output << "Allocated ";
-            size_t pos = command.find("malloc") + 6;
-            while (pos < command.length() && command[pos] == ' ')
-                pos++;
+            double floor = baseline[test.type] * (1 - threshold);
+            if (result.passed && result.opsPerSecond < floor)
+            {
+                result.passed = false;
+                result.errorMessage = "Throughput regression: " + to_string((long long)result.opsPerSecond) + " ops/s, baseline " +
+                                      to_string((long long)baseline[test.type]) + " ops/s";
+            }
+        }
+        return result;
+    }
 
-            string sizeStr;
-            while (pos < command.length() && isdigit(command[pos]))
+    // Two CPUs free the same slab object at once, many times over: exactly
+    // one free may succeed each round, and no object may be handed out twice
+    // afterwards
+    TestResult runSlabDoubleFreeRace()
+    {
+        TestResult result{"SLAB_RACE", true, 0.0, 0, 0, ""};
+        const int rounds = 500;
+        SlabAllocator slab(1 << 20, 2);
+        auto start = steady_clock::now();
+        for (int r = 0; r < rounds && result.passed; r++)
+        {
+            long long off = slab.alloc(0, 40);
+            atomic<int> ready(0);
+            bool freed[2];
+            auto racer = [&](int cpu)
+            {
+                ready++;
+                while (ready.load() < 2)
+                    ;
+                freed[cpu] = slab.free(cpu, off);
+            };
+            thread a(racer, 0), b(racer, 1);
+            a.join();
+            b.join();
+            result.commandsExecuted += 3;
+            if (off < 0 || freed[0] + freed[1] != 1)
             {
-                sizeStr += command[pos];
-                pos++;
+                result.passed = false;
+                result.errorMessage = "round " + to_string(r) + ": " + to_string(freed[0] + freed[1]) + " of 2 frees succeeded";
             }
+        }
+        // Every object the race put back must come out once
+        set<long long> seen;
+        for (int cpu = 0; cpu < 2 && result.passed; cpu++)
+        {
+            for (int i = 0; i < rounds; i++)
+            {
+                long long off = slab.alloc(cpu, 40);
+                result.commandsExecuted++;
+                if (off >= 0 && !seen.insert(off).second)
+                {
+                    result.passed = false;
+                    result.errorMessage = "offset " + to_string(off) + " handed out twice";
+                    break;
+                }
+            }
+        }
+        result.executionTime = duration<double, milli>(steady_clock::now() - start).count();
+        return result;
+    }
+
+    // A fully resident 2 MiB region collapses into a huge page even when the
+    // pool has no 512 free frames besides the region's own, and one with a
+    // swapped-out page does not
+    TestResult runThpCollapse()
+    {
+        TestResult result{"THP_COLLAPSE", true, 0.0, 0, 0, ""};
+        const int others = 8;
+        VirtualMemory vm(PT_ENTRIES + others);
+        vm.setHugePages(THP_PROMOTE, false);
+        unsigned long long paddr;
+        int shift = 0;
+        auto start = steady_clock::now();
+        // Another process holds the rest of the pool
+        for (int i = 0; i < others; i++)
+            vm.translate(2, (unsigned long long)i << PAGE_SHIFT, false, paddr);
+        for (int i = 0; i < PT_ENTRIES; i++)
+            vm.translate(1, (unsigned long long)i << PAGE_SHIFT, true, paddr);
+        vm.translate(1, 0, false, paddr, shift);
+        result.commandsExecuted = others + PT_ENTRIES + 1;
+        if (shift != HUGE_SHIFT)
+        {
+            result.passed = false;
+            result.errorMessage = "region still mapped with " + to_string(1 << shift) + "-byte pages";
+        }
+
+        // A region with a swapped-out page must not collapse: its page comes
+        // back through a major fault, not as part of a fresh huge page
+        VirtualMemory swapping(2 * PT_ENTRIES);
+        swapping.setHugePages(THP_PROMOTE, false);
+        for (int i = 0; i < PT_ENTRIES - 1; i++)
+            swapping.translate(1, (unsigned long long)i << PAGE_SHIFT, true, paddr);
+        // Another process pushes some of them out, then makes room again
+        for (int i = 0; i < PT_ENTRIES + 2; i++)
+            swapping.translate(2, (unsigned long long)i << PAGE_SHIFT, false, paddr);
+        swapping.destroyProcess(2);
+        swapping.translate(1, (unsigned long long)(PT_ENTRIES - 1) << PAGE_SHIFT, true, paddr, shift);
+        int majorFaults = 0;
+        for (int i = 0; i < PT_ENTRIES - 1; i++)
+            majorFaults += swapping.translate(1, (unsigned long long)i << PAGE_SHIFT, false, paddr) == XLATE_MAJOR_FAULT;
+        result.commandsExecuted += 3 * PT_ENTRIES + 2;
+        result.executionTime = duration<double, milli>(steady_clock::now() - start).count();
+        if (result.passed && (shift != PAGE_SHIFT || majorFaults == 0))
+        {
+            result.passed = false;
+            result.errorMessage = "region with swapped pages collapsed (" + to_string(majorFaults) + " major faults)";
+        }
+        return result;
+    }
 
-            if (!sizeStr.empty())
+    // Replays trace serially and on threads, returning "" when both saw the
+    // same hits and misses
+    template <class Policy>
+    string compareShards(const vector<unsigned long long> &trace, int threads)
+    {
+        const int size = 32 * 1024, blockSize = 64, assoc = 8;
+        CacheT<Policy> serial(size, blockSize, assoc), sharded(size, blockSize, assoc);
+        if constexpr (is_same<Policy, OptPolicy>::value)
+        {
+            serial.policy().prepare(trace, blockSize);
+            sharded.policy().prepare(trace, blockSize);
+        }
+        serial.replay(trace, 1);
+        sharded.replay(trace, threads);
+        if (serial.getHits() == sharded.getHits() && serial.getMisses() == sharded.getMisses())
+            return "";
+        return string(Policy::name()) + ": serial " + to_string(serial.getHits()) + "/" + to_string(serial.getMisses()) +
+               " hits/misses, " + to_string(threads) + " threads " + to_string(sharded.getHits()) + "/" +
+               to_string(sharded.getMisses());
+    }
+
+    // Sharding the sets over threads must not change any policy's result
+    TestResult runShardedReplay()
+    {
+        TestResult result{"CACHE_SHARDS", true, 0.0, 0, 0, ""};
+        // Skewed addresses so every policy sees both hits and evictions
+        vector<unsigned long long> trace(200000);
+        unsigned long long x = 88172645463325252ULL;
+        for (unsigned long long &addr : trace)
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            addr = (x % 4 ? x % (48 * 1024) : x % (1 << 22)) & ~7ULL;
+        }
+        auto start = steady_clock::now();
+        string errors[] = {compareShards<FifoPolicy>(trace, 4),   compareShards<LruPolicy>(trace, 4),
+                           compareShards<PlruPolicy>(trace, 4),   compareShards<SrripPolicy>(trace, 4),
+                           compareShards<BrripPolicy>(trace, 4),  compareShards<RandomPolicy>(trace, 4),
+                           compareShards<OptPolicy>(trace, 4)};
+        result.executionTime = duration<double, milli>(steady_clock::now() - start).count();
+        result.commandsExecuted = 7 * 2;
+        for (const string &error : errors)
+        {
+            if (!error.empty())
             {
-                int size = stoi(sizeStr);
-                output << size << " bytes at address " << (rand() % 1000);
+                result.passed = false;
+                result.errorMessage += (result.errorMessage.empty() ? "" : "; ") + error;
             }
         }
-        else if (command.find("free") != string::npos)
+        return result;
+    }
+
+    // Every point of the sweep's curves must count as many misses as an LRU
+    // cache of that geometry replaying the same trace
+    TestResult runSweepAgainstLru()
+    {
+        TestResult result{"SWEEP_LRU", true, 0.0, 0, 0, ""};
+        vector<unsigned long long> trace(50000);
+        unsigned long long x = 2463534242ULL;
+        for (unsigned long long &addr : trace)
         {
-            output << "Freed Memory at address " << (rand() % 1000);
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            addr = x % 3 ? x % (24 * 1024) : x % (1 << 20);
         }
-        else if (command.find("CacheAccess") != string::npos)
+        auto start = steady_clock::now();
+        CacheSweep sweep({32, 64}, 1024, 16 * 1024, 16);
+        for (unsigned long long addr : trace)
+            sweep.access(addr);
+        for (const SweepPoint &p : sweep.curve())
         {
-            output << "Cache Access at address " << (rand() % 1000) << " - ";
-            if (rand() % 100 < 80)
+            long long lines = p.size / p.blockSize;
+            int assoc = p.assoc ? p.assoc : (int)lines;
+            // CacheT tops out at 64 ways
+            if (assoc > 64)
+                continue;
+            CacheT<LruPolicy> lru((int)p.size, p.blockSize, assoc);
+            lru.replay(trace);
+            result.commandsExecuted++;
+            if (lru.getMisses() != p.misses)
             {
-                output << "HIT";
+                result.passed = false;
+                result.errorMessage = "block " + to_string(p.blockSize) + ", size " + to_string(p.size) + ", " +
+                                      (p.assoc ? to_string(p.assoc) + "-way" : string("fully associative")) +
+                                      ": sweep " + to_string(p.misses) + " misses, LRU " + to_string(lru.getMisses());
+                break;
             }
-            else
+        }
+        result.executionTime = duration<double, milli>(steady_clock::now() - start).count();
+        return result;
+    }
+
+    // Belady's string 1 2 3 4 1 2 5 1 2 3 4 5: FIFO faults more with 4
+    // frames than with 3, while the stack algorithms (LRU, OPT) cannot
+    TestResult runPageFaultCounts()
+    {
+        TestResult result{"PAGE_FAULTS", true, 0.0, 0, 0, ""};
+        const vector<unsigned long long> pages = {1, 2, 3, 4, 1, 2, 5, 1, 2, 3, 4, 5};
+        // policy -> faults with 3 and 4 frames
+        const vector<pair<string, pair<long long, long long>>> expected = {
+            {"fifo", {9, 10}}, {"lru", {10, 8}}, {"clock", {9, 10}},
+            {"clockpro", {10, 8}}, {"arc", {10, 7}}, {"opt", {7, 6}}};
+        vector<int> ids;
+        int distinct = densePages(pages, ids);
+        vector<long long> nextUse = nextUseIndex(ids, distinct);
+        auto start = steady_clock::now();
+        for (const auto &e : expected)
+        {
+            for (int frames = 3; frames <= 4; frames++)
             {
-                output << "MISS";
+                unique_ptr<PageReplacer> r = makeReplacer(e.first, frames, distinct, nextUse);
+                long long faults = 0;
+                for (int id : ids)
+                    faults += !r->access(id);
+                result.commandsExecuted += ids.size();
+                long long want = frames == 3 ? e.second.first : e.second.second;
+                if (faults != want && result.passed)
+                {
+                    result.passed = false;
+                    result.errorMessage = e.first + " with " + to_string(frames) + " frames: " + to_string(faults) +
+                                          " faults, expected " + to_string(want);
+                }
             }
         }
-        else if (command.find("BuddyAlloc") != string::npos)
+        result.executionTime = duration<double, milli>(steady_clock::now() - start).count();
+        return result;
+    }
+
+    // Reads every record of a trace file and how many were skipped
+    static vector<TraceRecord> readTrace(const string &path, long long &skipped)
+    {
+        TraceReader in(path);
+        vector<TraceRecord> recs;
+        TraceRecord batch[64];
+        size_t got;
+        while ((got = in.read(batch, 64)) > 0)
+            recs.insert(recs.end(), batch, batch + got);
+        skipped = in.skippedLines();
+        return recs;
+    }
+
+    static bool sameRecords(const vector<TraceRecord> &a, const vector<TraceRecord> &b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); i++)
+            if (a[i].addr != b[i].addr || a[i].write != b[i].write || a[i].core != b[i].core)
+                return false;
+        return true;
+    }
+
+    // Converts text to raw to varint and back to text without losing a
+    // record, and every format skips the same kinds of malformed records
+    TestResult runTraceFormats()
+    {
+        TestResult result{"TRACE_FORMATS", true, 0.0, 0, 0, ""};
+        string dir = filesystem::temp_directory_path().string() + "/memsim_trace_" + to_string(getpid());
+        filesystem::create_directories(dir);
+        auto fail = [&](const string &message)
+        {
+            if (result.passed)
+                result.errorMessage = message;
+            result.passed = false;
+        };
+        auto start = steady_clock::now();
         {
-            output << "buddy allocated " << (rand() % 512) << " bytes";
+            ofstream text(dir + "/in.txt");
+            text << "R 0x1000\n3 W 0x7fffffffffffff\n127 R 0\n0 W 0x10\n# comment\n5 R 4096 0x400123\n";
         }
-        else if (command.find("dump") != string::npos)
+        long long skipped;
+        vector<TraceRecord> original = readTrace(dir + "/in.txt", skipped);
+        const char *chain[] = {"in.txt", "trace.raw", "trace.var", "out.txt"};
+        const TraceFormat formats[] = {TRACE_RAW, TRACE_VARINT, TRACE_TEXT};
+        for (int i = 0; i < 3; i++)
         {
-            output << "Memory Dump:\n";
-            output << "0x000-0x0FF: FREE 256 bytes\n";
-            output << "Total Free: 256 bytes";
+            long long skippedHere;
+            vector<TraceRecord> recs = readTrace(dir + "/" + chain[i], skippedHere);
+            TraceWriter out(dir + "/" + chain[i + 1], formats[i]);
+            for (const TraceRecord &rec : recs)
+                if (!out.write(rec))
+                    fail(string("could not write ") + chain[i + 1]);
+            if (!out.close())
+                fail(string("could not close ") + chain[i + 1]);
+            result.commandsExecuted += recs.size();
         }
-        else if (command.find("stats") != string::npos)
+        vector<TraceRecord> back = readTrace(dir + "/out.txt", skipped);
+        if (original.size() != 5 || skipped != 0)
+            fail("read " + to_string(original.size()) + " of the 5 text records");
+        else if (!sameRecords(original, back))
+            fail("text -> raw -> varint -> text changed the records");
+
+        // One malformed record between two good ones in each format
         {
-            output << "Statistics:\n";
-            output << "Allocations: " << (rand() % 10) << "\n";
-            output << "Free Memory: " << (rand() % 256) << " bytes\n";
-            output << "Utilization: " << (rand() % 100) << "%";
+            ofstream text(dir + "/bad.txt");
+            text << "R 16\nW 18446744073709551616\nR 0x10000000000000000\n65536 R 16\nR 16 99999999999999999999\nR 32\n";
+            ofstream raw(dir + "/bad.raw", ios::binary);
+            unsigned long long words[] = {16, 32};
+            raw.write("MTRCRAW1", 8);
+            raw.write((const char *)words, sizeof(words));
+            raw.write("\x01\x02\x03", 3);
+            // 16 on core 0, 0 on core 65536, 32 back on core 0
+            ofstream var(dir + "/bad.var", ios::binary);
+            const unsigned char body[] = {0x80, 0x01, 0x7e, 0x80, 0x80, 0x04, 0x82, 0x02, 0x00};
+            var.write("MTRCVAR2", 8);
+            var.write((const char *)body, sizeof(body));
         }
-        else if (command.find("Cachestats") != string::npos)
+        const pair<const char *, long long> bad[] = {{"bad.txt", 4}, {"bad.raw", 1}, {"bad.var", 1}};
+        for (const auto &b : bad)
         {
-            output << "Cache Statistics:\n";
-            output << "L1 Hit Rate: " << (rand() % 100) << "%\n";
-            output << "L2 Hit Rate: " << (rand() % 100) << "%\n";
-            output << "Total Accesses: " << (rand() % 1000);
+            vector<TraceRecord> recs = readTrace(dir + "/" + b.first, skipped);
+            result.commandsExecuted += recs.size() + skipped;
+            if (skipped != b.second || recs.size() != 2 || recs[0].addr != 16 || recs[1].addr != 32)
+                fail(string(b.first) + ": " + to_string(recs.size()) + " records read, " + to_string(skipped) +
+                     " skipped, expected 2 and " + to_string(b.second));
         }
-
-        return output.str();
+        filesystem::remove_all(dir);
+        result.executionTime = duration<double, milli>(steady_clock::now() - start).count();
+        return result;
     }
 
-    TestResult runTestFile(const string &filename)
+    // Ping-pong writes and read sharing between cores move the block through
+    // the expected MESI states with one invalidation per remote copy, and a
+    // replay whose first epoch runs in parallel prints what a serial one does
+    TestResult runCoherence()
     {
-        TestResult result;
-        result.testName = filename;
-        result.passed = true;
-        result.executionTime = 0.0;
-        result.commandsExecuted = 0;
-        result.errorMessage = "";
-
-        auto start = high_resolution_clock::now();
-
-        ifstream testFile(filename);
-        if (!testFile.is_open())
+        TestResult result{"COHERENCE", true, 0.0, 0, 0, ""};
+        HierarchyConfig cfg;
+        cfg.levels.push_back({"L1", 1024, 64, 4, "lru", 1, NINE});
+        cfg.levels.push_back({"LLC", 16384, 64, 8, "lru", 10, NINE});
+        cfg.memoryLatency = 100;
+        const unsigned long long block = 0x1000;
+        string dir = filesystem::temp_directory_path().string() + "/memsim_mesi_" + to_string(getpid());
+        filesystem::create_directories(dir);
+        auto fail = [&](const string &message)
         {
+            if (result.passed)
+                result.errorMessage = message;
             result.passed = false;
-            result.errorMessage = "Could not open test file";
-            return result;
+        };
+        // CoherentSystem replays trace files, so each step goes through one
+        auto replay = [&](CoherentSystem &sys, const vector<TraceRecord> &recs, int threads)
+        {
+            {
+                TraceWriter out(dir + "/step.var", TRACE_VARINT);
+                for (const TraceRecord &rec : recs)
+                    out.write(rec);
+            }
+            TraceReader in(dir + "/step.var");
+            sys.replay(in, threads);
+            result.commandsExecuted += recs.size();
+        };
+        auto step = [&](CoherentSystem &sys, int core, bool write, const vector<MesiState> &states, long long invalidations)
+        {
+            replay(sys, {{block + 4 * core, write, (unsigned short)core, 0}}, 1);
+            const char names[] = "ISEM";
+            string got, want;
+            for (size_t c = 0; c < states.size(); c++)
+            {
+                got += names[sys.state(c, block)];
+                want += names[states[c]];
+            }
+            if (got != want || sys.getInvalidations() != invalidations)
+                fail(string("core ") + to_string(core) + (write ? " write" : " read") + ": states " + got + ", " +
+                     to_string(sys.getInvalidations()) + " invalidations, expected " + want + ", " +
+                     to_string(invalidations));
+        };
+        auto start = steady_clock::now();
+
+        CoherentSystem pingPong(cfg, 2);
+        for (int i = 0; i < 50; i++)
+        {
+            step(pingPong, 0, true, {MESI_M, MESI_I}, 2 * i);
+            step(pingPong, 1, true, {MESI_I, MESI_M}, 2 * i + 1);
         }
 
-        string line;
-        while (getline(testFile, line))
+        CoherentSystem sharing(cfg, 3);
+        step(sharing, 0, false, {MESI_E, MESI_I, MESI_I}, 0);
+        step(sharing, 1, false, {MESI_S, MESI_S, MESI_I}, 0);
+        step(sharing, 2, false, {MESI_S, MESI_S, MESI_S}, 0);
+        step(sharing, 0, true, {MESI_M, MESI_I, MESI_I}, 2);
+        step(sharing, 1, false, {MESI_S, MESI_S, MESI_I}, 2);
+        step(sharing, 1, true, {MESI_I, MESI_M, MESI_I}, 3);
+
+        // A first epoch of private blocks per core, then one of shared blocks
+        vector<TraceRecord> trace;
+        unsigned long long x = 88172645463325252ULL;
+        for (int epoch = 0; epoch < 2; epoch++)
         {
-            if (line.empty() || line[0] == '#')
-                continue;
-
-            string command = line;
-            size_t pos = command.find(' ');
-            if (pos != string::npos)
+            for (int i = 0; i < (1 << 16); i++)
             {
-                command = command.substr(pos + 1);
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                unsigned short core = x % 4;
+                unsigned long long addr = (x >> 8) % (64 * 1024);
+                if (epoch == 0)
+                    addr += (unsigned long long)core << 20;
+                trace.push_back({addr, (x >> 40) % 3 == 0, core, 0});
             }
+        }
+        string printed[2];
+        long long parallelEpochs[2];
+        for (int run = 0; run < 2; run++)
+        {
+            CoherentSystem sys(cfg, 4);
+            replay(sys, trace, run ? 4 : 1);
+            parallelEpochs[run] = sys.getParallelEpochs();
+            ostringstream output;
+            streambuf *console = cout.rdbuf(output.rdbuf());
+            sys.stats();
+            cout.rdbuf(console);
+            // Everything but the epoch line, which says how it was run
+            istringstream lines(output.str());
+            string line;
+            while (getline(lines, line))
+                if (line.compare(0, 7, "Epochs:") != 0)
+                    printed[run] += line + "\n";
+        }
+        if (parallelEpochs[0] != 0 || parallelEpochs[1] != 1)
+            fail(to_string(parallelEpochs[1]) + " epochs ran in parallel on 4 threads, expected 1");
+        else if (printed[0] != printed[1])
+            fail("stats after a parallel epoch differ from the serial replay");
+        filesystem::remove_all(dir);
+        result.executionTime = duration<double, milli>(steady_clock::now() - start).count();
+        return result;
+    }
 
-            string output = executeCommand(command);
-            if (!validateOutput(command, output))
+    // Runs each test's commands through runBatch(), which writes straight to
+    // file descriptor 1, and compares what it wrote with the interactive
+    // transcript in the golden file minus the prompt lines
+    TestResult runBatchGolden(const vector<TestCase> &tests)
+    {
+        TestResult result{"BATCH", true, 0.0, 0, 0, ""};
+        string dir = filesystem::temp_directory_path().string() + "/memsim_batch_" + to_string(getpid());
+        filesystem::create_directories(dir);
+        auto start = steady_clock::now();
+        for (const TestCase &test : tests)
+        {
+            ifstream golden("tests/golden/" + test.type + ".out");
+            string expected, line;
+            while (getline(golden, line))
+                if (line.compare(0, 5, "mem> ") != 0)
+                    expected += line + "\n";
+            {
+                // Comments and blank lines must not produce output
+                ofstream batch(dir + "/" + test.type + ".cmd");
+                batch << "# " << test.type << "\n\n";
+                for (const string &command : test.commands)
+                    batch << command << "\n";
+            }
+            string outPath = dir + "/" + test.type + ".txt";
+            cout.flush();
+            int console = dup(STDOUT_FILENO);
+            int fd = open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+            {
+                Simulator sim;
+                // The run's timing line goes to cerr; keep it off the report
+                streambuf *errors = cerr.rdbuf(nullptr);
+                runBatch(sim, dir + "/" + test.type + ".cmd", false);
+                cerr.rdbuf(errors);
+            }
+            dup2(console, STDOUT_FILENO);
+            close(console);
+            result.commandsExecuted += test.commands.size();
+            ifstream out(outPath);
+            stringstream got;
+            got << out.rdbuf();
+            if (got.str() != expected && result.passed)
             {
                 result.passed = false;
-                result.errorMessage = "Command validation failed: " + command;
-                break;
+                result.errorMessage = test.type + ": --batch output differs from tests/golden/" + test.type + ".out";
             }
-            result.commandsExecuted++;
         }
-
-        auto end = high_resolution_clock::now();
-        result.executionTime = duration_cast<microseconds>(end - start).count() / 1000.0;
-
-        testFile.close();
+        filesystem::remove_all(dir);
+        result.executionTime = duration<double, milli>(steady_clock::now() - start).count();
         return result;
     }
 
+    void report(const TestResult &result, const string &type)
+    {
+        cout << "Test Type: " << type << endl;
+        cout << "Commands to execute: " << result.commandsExecuted << endl;
+        cout << "Test completed in " << result.executionTime << " ms" << endl;
+        if (result.opsPerSecond > 0)
+            cout << "Throughput: " << result.opsPerSecond << " ops/s" << endl;
+        cout << "Result: " << (result.passed ? "PASS" : "FAIL") << endl;
+
+        if (!result.errorMessage.empty())
+        {
+            cout << "Error: " << result.errorMessage << endl;
+        }
+    }
+
 public:
-    TestRunner()
+    TestRunner(bool updateGolden, bool updateBaseline, bool measurePerf, double threshold)
+        : updateGolden(updateGolden), updateBaseline(updateBaseline), measurePerf(measurePerf), threshold(threshold)
     {
         loadExpectedOutputs("tests/expected_outputs.txt");
+        loadBaseline("tests/perf_baseline.txt");
     }
 
-    void runAllTests()
+    bool runAllTests()
     {
         cout << "Starting OS Memory Simulator Test Runner..." << endl;
         cout << "OS Memory Simulator Test Suite" << endl;
 
-        vector<string> testFiles = {
-            "tests/test_cases.txt"};
-
-        for (const string &testFile : testFiles)
+        vector<TestCase> tests = loadTestCases("tests/test_cases.txt");
+        if (tests.empty())
         {
-            cout << "Running Test Case: " << testFile << endl;
+            cout << "No test cases found in tests/test_cases.txt" << endl;
+            return false;
+        }
+        for (const TestCase &test : tests)
+        {
+            cout << "Running Test Case: " << test.type << endl;
 
-            TestResult result = runTestFile(testFile);
+            TestResult result = runTest(test);
             results.push_back(result);
-
-            cout << "Test Type: " << getTestType(testFile) << endl;
-            cout << "Commands to execute: " << result.commandsExecuted << endl;
-            cout << "Test completed in " << result.executionTime << " ms" << endl;
-            cout << "Result: " << (result.passed ? "PASS" : "FAIL") << endl;
-
-            if (!result.errorMessage.empty())
-            {
-                cout << "Error: " << result.errorMessage << endl;
-            }
+            report(result, getTestType(test.type));
         }
-
-        printSummary();
+        cout << "Running Test Case: SLAB_RACE" << endl;
+        results.push_back(runSlabDoubleFreeRace());
+        report(results.back(), "Concurrent Slab Free");
+        cout << "Running Test Case: THP_COLLAPSE" << endl;
+        results.push_back(runThpCollapse());
+        report(results.back(), "Huge Page Promotion");
+        cout << "Running Test Case: CACHE_SHARDS" << endl;
+        results.push_back(runShardedReplay());
+        report(results.back(), "Sharded Cache Replay");
+        cout << "Running Test Case: SWEEP_LRU" << endl;
+        results.push_back(runSweepAgainstLru());
+        report(results.back(), "Miss Ratio Sweep");
+        cout << "Running Test Case: PAGE_FAULTS" << endl;
+        results.push_back(runPageFaultCounts());
+        report(results.back(), "Page Replacement Faults");
+        cout << "Running Test Case: TRACE_FORMATS" << endl;
+        results.push_back(runTraceFormats());
+        report(results.back(), "Trace Format Round Trip");
+        cout << "Running Test Case: COHERENCE" << endl;
+        results.push_back(runCoherence());
+        report(results.back(), "MESI Coherence");
+        cout << "Running Test Case: BATCH" << endl;
+        results.push_back(runBatchGolden(tests));
+        report(results.back(), "Batch Mode");
+        if (updateBaseline)
+            saveBaseline("tests/perf_baseline.txt");
+
+        return printSummary();
     }
 
-    void printSummary()
+    bool printSummary()
     {
         cout << "TEST SUMMARY" << endl;
 
@@ -348,17 +946,43 @@ public:
         {
             cout << "  " << result.testName << ": "
                  << (result.passed ? "PASS" : "FAIL")
-                 << " (" << result.executionTime << " ms)" << endl;
+                 << " (" << result.executionTime << " ms";
+            if (result.opsPerSecond > 0)
+                cout << ", " << result.opsPerSecond << " ops/s";
+            cout << ")" << endl;
         }
 
         cout << endl
              << "Test suite completed!" << endl;
+        return passedTests == totalTests;
     }
 };
 
-int main()
+int main(int argc, char **argv)
 {
-    TestRunner runner;
-    runner.runAllTests();
-    return 0;
-}
\ No newline at end of file
+    bool updateGolden = false, updateBaseline = false, measurePerf = false;
+    // Allowed throughput drop before a test fails; generous by default since
+    // short timed runs are noisy
+    double threshold = 0.5;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--update-golden")
+            updateGolden = true;
+        else if (arg == "--update-baseline")
+            updateBaseline = measurePerf = true;
+        else if (arg == "--perf")
+            measurePerf = true;
+        else if (arg == "--no-perf")
+            measurePerf = false;
+        else if (arg == "--threshold" && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else
+        {
+            cout << "Usage: test_runner [--update-golden] [--update-baseline] [--threshold <fraction>] [--perf|--no-perf]" << endl;
+            return 2;
+        }
+    }
+    TestRunner runner(updateGolden, updateBaseline, measurePerf, threshold);
+    return runner.runAllTests() ? 0 : 1;
+}